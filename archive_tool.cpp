@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "command_line.hpp"
+#include "crop_archive.hpp"
+#include "embedding_sink.hpp"
+
+/*
+ * reads the segments detect_faces --archive writes.
+ *
+ *   archive_tool list segment.arc...
+ *   archive_tool extract segment.arc record out.jpg
+ *   archive_tool export segment.arc... [--out=.]
+ *
+ * list prints one line per record.  extract writes one record's crop to a
+ * file and prints its embedding.  export writes every record as a .jpg and
+ * .json pair named after the segment and record number, the files
+ * detect_faces writes without --archive.  records whose crop was dropped
+ * have no jpeg, and export writes only their .json.
+ */
+
+static void write_file(std::string const & filename, std::vector<unsigned char> const & data) {
+  FILE * f = std::fopen(filename.c_str(), "wb");
+  if (f == nullptr) {
+    throw std::runtime_error("can't open " + filename);
+  }
+  size_t written = std::fwrite(data.data(), 1, data.size(), f);
+  if (std::fclose(f) != 0 || written != data.size()) {
+    throw std::runtime_error("can't write " + filename);
+  }
+}
+
+static std::string base_name(std::string path) {
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos) {
+    path = path.substr(slash + 1);
+  }
+  size_t dot = path.rfind('.');
+  return dot == std::string::npos ? path : path.substr(0, dot);
+}
+
+static void list(std::string const & filename) {
+  CropArchiveReader reader(filename);
+  std::cout << filename << ": " << reader.size() << " records"
+            << (reader.has_footer() ? "" : ", no index (segment was not closed)") << "\n";
+  for (size_t i = 0; i < reader.size(); i++) {
+    CropRecord r = reader.read(i);
+    std::cout << std::setw(6) << i << " frame " << r.frame_id << " stream " << r.stream
+              << " at " << r.timestamp << " " << r.x0 << "," << r.y0 << "-" << r.x1 << "," << r.y1
+              << " confidence " << r.confidence << " jpeg " << r.jpeg.size()
+              << " embedding " << r.embedding.size() << "\n";
+  }
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+  const std::string command = cmd.positional(0);
+  if (cmd.positional_count() < 2 || (command != "list" && command != "extract" && command != "export")) {
+    std::cerr << "usage: archive_tool list segment.arc...\n"
+                 "       archive_tool extract segment.arc record out.jpg\n"
+                 "       archive_tool export segment.arc... [--out=.]" << std::endl;
+    return 1;
+  }
+
+  try {
+    if (command == "list") {
+      for (size_t i = 1; i < cmd.positional_count(); i++) {
+        list(cmd.positional(i));
+      }
+    } else if (command == "extract") {
+      if (cmd.positional_count() < 4) {
+        std::cerr << "usage: archive_tool extract segment.arc record out.jpg" << std::endl;
+        return 1;
+      }
+      CropArchiveReader reader(cmd.positional(1));
+      CropRecord r = reader.read(std::stoul(cmd.positional(2)));
+      if (r.jpeg.empty()) {
+        std::clog << "record " << cmd.positional(2) << " has no crop\n";
+      } else {
+        write_file(cmd.positional(3), r.jpeg);
+      }
+      write_json_array(std::cout, r.embedding);
+      std::cout << std::endl;
+    } else {
+      const std::string out = cmd.get("out", ".");
+      size_t count = 0;
+      for (size_t i = 1; i < cmd.positional_count(); i++) {
+        CropArchiveReader reader(cmd.positional(i));
+        const std::string prefix = out + "/" + base_name(cmd.positional(i)) + "-";
+        for (size_t k = 0; k < reader.size(); k++) {
+          CropRecord r = reader.read(k);
+          std::ostringstream name;
+          name << prefix << std::setfill('0') << std::setw(6) << k;
+          if (!r.jpeg.empty()) {
+            write_file(name.str() + ".jpg", r.jpeg);
+          }
+          std::ofstream fs(name.str() + ".json", std::ios::out | std::ios::trunc);
+          write_json_array(fs, r.embedding);
+          count++;
+        }
+      }
+      std::clog << "exported " << count << " records to " << out << "\n";
+    }
+  } catch (std::exception const & e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
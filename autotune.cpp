@@ -0,0 +1,140 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+
+#include "face_detector.hpp"
+#include "facenet.hpp"
+#include "inference_context.hpp"
+#include "command_line.hpp"
+#include "benchmark.hpp"
+#include "tuning_config.hpp"
+
+/*
+ * sweeps the detector's in-flight requests and CPU streams and facenet's
+ * batch size on synthetic frames, then writes the fastest combination to a
+ * file that main (--tuning=...) and TuningConfig::apply can load.
+ *
+ *   autotune [device] [--output=tuning.conf] [--frames=100]
+ *            [--max-latency=0] [--max-batch=16] [--width=1920] [--height=1080]
+ *
+ * --max-latency rejects detector settings whose p99 latency in ms is above
+ * it.  facenet runs one synchronous request per instance, so only its batch
+ * is swept and it is tuned for a single stream.
+ */
+
+static void report(std::string const & what, BenchmarkResult const & r) {
+  std::cout << std::setw(28) << std::left << what << std::right
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << r.fps << " fps"
+            << std::setw(10) << r.p50 << " ms p50"
+            << std::setw(10) << r.p99 << " ms p99" << std::endl;
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+
+  const std::string plugin_name = cmd.positional(0, "CPU");
+  const std::string output = cmd.get("output", "tuning.conf");
+  const size_t frames = cmd.get<size_t>("frames", 100);
+  const double max_latency = cmd.get<double>("max-latency", 0);
+  const size_t max_batch = cmd.get<size_t>("max-batch", 16);
+  const int width = cmd.get<int>("width", 1920);
+  const int height = cmd.get<int>("height", 1080);
+
+  const std::string plugin_path = "/opt/intel/openvino/deployment_tools/inference_engine/lib/";
+  const std::string model_precision = plugin_name == "MYRIAD" ? "FP16" : "FP32";
+
+  InferenceContextOptions context_options;
+  context_options.plugin_path = plugin_path;
+  std::shared_ptr<InferenceContext> context = std::make_shared<InferenceContext>(context_options);
+
+  std::vector<unsigned char> pixels(3 * width * height, 128);
+  RGB24 frame(pixels.data(), 3 * width, 0, 0, width, height);
+  RGB24 crop = frame.SubImage(Rect{0, 0, 160, 160});
+
+  // streams only exist on CPU, 0 leaves other devices alone
+  std::vector<size_t> stream_counts(1, 0);
+  if (plugin_name == "CPU") {
+    stream_counts.clear();
+    size_t cores = std::max<unsigned>(std::thread::hardware_concurrency(), 1);
+    for (size_t s = 1; s <= cores; s *= 2) {
+      stream_counts.push_back(s);
+    }
+  }
+
+  TuningConfig best;
+  best.device = plugin_name;
+
+  BenchmarkResult best_detector{0, 0, 0};
+  for (size_t streams : stream_counts) {
+    // each stream needs a request of its own, a second one hides the handoff
+    size_t base = std::max<size_t>(streams, 1);
+    for (size_t requests : {base, 2 * base}) {
+      DetectorOptions options;
+      options.num_requests = requests;
+      options.cpu_streams = streams;
+      options.context = context;
+      if (plugin_name != "MYRIAD") {
+        options.input_layout = Layout::NHWC;
+      }
+
+      FaceDetector detector(
+        "../face-detection-model/" + model_precision + "/face-detection-adas-0001.xml",
+        "../face-detection-model/" + model_precision + "/face-detection-adas-0001.bin",
+        plugin_name, plugin_path, options);
+      BenchmarkResult r = benchmark_detector(detector, frame, frames);
+
+      std::ostringstream what;
+      what << "detector streams " << streams << " requests " << requests;
+      report(what.str(), r);
+
+      if ((max_latency <= 0 || r.p99 <= max_latency) && r.fps > best_detector.fps) {
+        best_detector = r;
+        best.detector_streams = streams;
+        best.detector_requests = requests;
+      }
+    }
+  }
+
+  BenchmarkResult best_facenet{0, 0, 0};
+  for (size_t batch = 1; batch <= max_batch; batch *= 2) {
+    FacenetOptions options;
+    options.max_batch = batch;
+    options.cpu_streams = plugin_name == "CPU" ? 1 : 0;
+    options.context = context;
+
+    Facenet facenet(
+      "../resnet50_128_caffe/" + model_precision + "/resnet50_128.xml",
+      "../resnet50_128_caffe/" + model_precision + "/resnet50_128.bin",
+      plugin_name, plugin_path, options);
+    BenchmarkResult r = benchmark_facenet(facenet, crop, frames);
+
+    std::ostringstream what;
+    what << "facenet batch " << batch;
+    report(what.str(), r);
+
+    if (r.fps > best_facenet.fps) {
+      best_facenet = r;
+      best.facenet_batch = batch;
+      best.facenet_streams = options.cpu_streams;
+    }
+  }
+
+  if (best.detector_requests == 0) {
+    std::cerr << "no detector setting met --max-latency=" << max_latency << std::endl;
+    return 1;
+  }
+
+  std::ostringstream comment;
+  comment << "written by autotune for " << plugin_name << " on " << width << "x" << height << " frames\n"
+          << "detector " << best_detector.fps << " fps, p99 " << best_detector.p99 << " ms\n"
+          << "facenet " << best_facenet.fps << " crops/s, p99 " << best_facenet.p99 << " ms";
+  best.save(output, comment.str());
+
+  std::cout << "wrote " << output << std::endl;
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "jpeglib.h"
+
+#include "command_line.hpp"
+#include "jpeg_encoder.hpp"
+
+/*
+ * compares JpegEncoder with the per-call setup process_jpeg used to do, on
+ * crops of a synthetic frame.
+ *
+ *   bench_jpeg [--sizes=64,160,320,1080] [--count=500] [--quality=90]
+ *              [--max-edge=96]
+ *
+ * each size is a square crop of a 1920x1080 frame, 1080 being the full
+ * frame height.  both encoders must produce the same bytes.  the last
+ * column encodes the same crops as thumbnails of at most --max-edge
+ * pixels, shrunk while encoding.
+ */
+
+#define LEGACY_BLOCK_SIZE 16384
+
+static void legacy_init_destination(j_compress_ptr cinfo) {
+  std::vector<JOCTET> * buffer = static_cast<std::vector<JOCTET> *>(cinfo->client_data);
+  buffer->resize(LEGACY_BLOCK_SIZE);
+  cinfo->dest->next_output_byte = &buffer->at(0);
+  cinfo->dest->free_in_buffer = buffer->size();
+}
+
+static boolean legacy_empty_output_buffer(j_compress_ptr cinfo) {
+  std::vector<JOCTET> * buffer = static_cast<std::vector<JOCTET> *>(cinfo->client_data);
+  size_t oldsize = buffer->size();
+  buffer->resize(oldsize + LEGACY_BLOCK_SIZE);
+  cinfo->dest->next_output_byte = &buffer->at(oldsize);
+  cinfo->dest->free_in_buffer = buffer->size() - oldsize;
+  return TRUE;
+}
+
+static void legacy_term_destination(j_compress_ptr cinfo) {
+  std::vector<JOCTET> * buffer = static_cast<std::vector<JOCTET> *>(cinfo->client_data);
+  buffer->resize(buffer->size() - cinfo->dest->free_in_buffer);
+}
+
+/*
+ * the old process_jpeg: a compressor, default tables and a destination set
+ * up per call, the output presized to the raw image, grown 16KB at a time,
+ * then copied out.  it copied from jpeg_mem_dest's unused buffer; this
+ * copies the real output so that the results can be compared.
+ */
+static void legacy_process_jpeg(RGB24 const & rgb, int quality, std::vector<unsigned char> & out) {
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  JSAMPROW row_pointer[1];
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+
+  out.resize(3 * rgb.dy() * rgb.dx());
+
+  unsigned long output_size = 0;
+  unsigned char * output_data = NULL;
+  jpeg_mem_dest(&cinfo, &output_data, &output_size);
+
+  cinfo.image_width = rgb.dx();
+  cinfo.image_height = rgb.dy();
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+
+  std::vector<JOCTET> buffer(LEGACY_BLOCK_SIZE);
+  cinfo.client_data = static_cast<void *>(&buffer);
+  cinfo.dest->init_destination = &legacy_init_destination;
+  cinfo.dest->empty_output_buffer = &legacy_empty_output_buffer;
+  cinfo.dest->term_destination = &legacy_term_destination;
+
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    row_pointer[0] = rgb.pix + cinfo.next_scanline * rgb.stride;
+    (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  out.assign(buffer.begin(), buffer.end());
+  free(output_data);
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+  const size_t count = cmd.get<size_t>("count", 500);
+  const int quality = cmd.get<int>("quality", 90);
+  const int max_edge = cmd.get<int>("max-edge", 96);
+
+  std::vector<int> sizes;
+  std::istringstream names(cmd.get("sizes", "64,160,320,1080"));
+  for (std::string name; std::getline(names, name, ',');) {
+    sizes.push_back(std::stoi(name));
+  }
+
+  // a smooth gradient with noise, so that the encoder has real work to do
+  const int width = 1920, height = 1080;
+  std::vector<unsigned char> pixels(3 * width * height);
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> noise(-16, 16);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      unsigned char * p = &pixels[3 * (y * width + x)];
+      p[0] = (unsigned char)std::max(0, std::min(255, x * 255 / width + noise(gen)));
+      p[1] = (unsigned char)std::max(0, std::min(255, y * 255 / height + noise(gen)));
+      p[2] = (unsigned char)std::max(0, std::min(255, 128 + noise(gen)));
+    }
+  }
+  RGB24 frame(pixels.data(), 3 * width, 0, 0, width, height);
+
+  typedef std::chrono::steady_clock Clock;
+  JpegEncoder encoder(quality);
+  std::vector<unsigned char> legacy_out, encoder_out;
+
+  std::cout << std::setw(6) << "size" << std::setw(12) << "bytes"
+            << std::setw(14) << "legacy us" << std::setw(14) << "encoder us" << std::setw(10) << "speedup"
+            << std::setw(14) << "thumb us" << std::endl;
+  for (int size : sizes) {
+    const int side = std::min(size, height);
+    // crops move across the frame, as faces would
+    auto crop = [&](size_t i) {
+      int x0 = (int)(i * 37 % (width - side + 1));
+      int y0 = (int)(i * 23 % (height - side + 1));
+      return frame.SubImage(Rect{x0, y0, x0 + side, y0 + side});
+    };
+
+    Clock::time_point t0 = Clock::now();
+    for (size_t i = 0; i < count; i++) {
+      legacy_process_jpeg(crop(i), quality, legacy_out);
+    }
+    Clock::time_point t1 = Clock::now();
+    for (size_t i = 0; i < count; i++) {
+      encoder.encode(crop(i), encoder_out);
+    }
+    Clock::time_point t2 = Clock::now();
+    std::vector<unsigned char> thumb_out;
+    for (size_t i = 0; i < count; i++) {
+      encoder.encode(crop(i), thumb_out, max_edge);
+    }
+    Clock::time_point t3 = Clock::now();
+
+    legacy_process_jpeg(crop(count - 1), quality, legacy_out);
+    if (legacy_out != encoder_out) {
+      std::cerr << "size " << side << ": the encoders disagree" << std::endl;
+      return 1;
+    }
+
+    double legacy_us = std::chrono::duration<double, std::micro>(t1 - t0).count() / count;
+    double encoder_us = std::chrono::duration<double, std::micro>(t2 - t1).count() / count;
+    double thumb_us = std::chrono::duration<double, std::micro>(t3 - t2).count() / count;
+    std::cout << std::setw(6) << side << std::setw(12) << encoder_out.size()
+              << std::fixed << std::setprecision(1)
+              << std::setw(14) << legacy_us << std::setw(14) << encoder_us
+              << std::setprecision(2) << std::setw(9) << legacy_us / encoder_us << "x"
+              << std::setprecision(1) << std::setw(14) << thumb_us << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "face_detector.hpp"
+#include "inference_context.hpp"
+#include "command_line.hpp"
+#include "benchmark.hpp"
+#include "image.hpp"
+
+/*
+ * feeds frames at the detector's own input size through the three ways the
+ * detector can take them and reports what each costs:
+ *
+ *   nchw    copied into a planar blob, plugin preprocessing enabled
+ *   nhwc    wrapped in place, the plugin converts layout and color
+ *   native  DetectorOptions::frame_width/height set, converted straight
+ *           into the request's input blob with no plugin preprocessing
+ *
+ *   bench_native [device] [--format=RGB24] [--frames=200] [--requests=2]
+ */
+
+static void report(std::string const & mode, BenchmarkResult const & r, double baseline) {
+  std::cout << std::setw(8) << mode
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << r.fps << " fps"
+            << std::setw(10) << r.p50 << " ms p50"
+            << std::setw(10) << r.p99 << " ms p99"
+            << std::setprecision(2)
+            << std::setw(10) << 1000. / r.fps << " ms/frame";
+  if (baseline > 0) {
+    std::cout << " (" << std::showpos << 1000. / r.fps - 1000. / baseline << std::noshowpos << " vs nchw)";
+  }
+  std::cout << std::endl;
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+
+  const std::string plugin_name = cmd.positional(0, "CPU");
+  const size_t frames = cmd.get<size_t>("frames", 200);
+  const size_t num_requests = cmd.get<size_t>("requests", 2);
+  const PixelFormat format = parse_pixel_format(cmd.get("format", "RGB24"));
+
+  const std::string plugin_path = "/opt/intel/openvino/deployment_tools/inference_engine/lib/";
+  const std::string model_precision = plugin_name == "MYRIAD" ? "FP16" : "FP32";
+  const std::string xml = "../face-detection-model/" + model_precision + "/face-detection-adas-0001.xml";
+  const std::string bin = "../face-detection-model/" + model_precision + "/face-detection-adas-0001.bin";
+
+  InferenceContextOptions context_options;
+  context_options.plugin_path = plugin_path;
+  std::shared_ptr<InferenceContext> context = std::make_shared<InferenceContext>(context_options);
+
+  DetectorOptions options;
+  options.num_requests = num_requests;
+  options.context = context;
+
+  std::unique_ptr<FaceDetector> detector(new FaceDetector(xml, bin, plugin_name, plugin_path, options));
+  const int width = detector->get_image_width();
+  const int height = detector->get_image_height();
+  std::cout << "frames: " << width << "x" << height << " " << to_string(format) << std::endl;
+
+  std::vector<unsigned char> pixels(image_bytes(format, width, height), 128);
+  Image frame = Image::wrap(format, pixels.data(), width, height);
+
+  BenchmarkResult nchw = benchmark_detector(*detector, frame, frames);
+  report("nchw", nchw, 0);
+
+  if (plugin_name != "MYRIAD") {
+    options.input_layout = Layout::NHWC;
+    detector.reset(new FaceDetector(xml, bin, plugin_name, plugin_path, options));
+    report("nhwc", benchmark_detector(*detector, frame, frames), nchw.fps);
+    options.input_layout = Layout::NCHW;
+  }
+
+  options.frame_width = width;
+  options.frame_height = height;
+  detector.reset(new FaceDetector(xml, bin, plugin_name, plugin_path, options));
+  if (!detector->is_native()) {
+    std::cerr << "detector did not take the native path" << std::endl;
+    return 1;
+  }
+  report("native", benchmark_detector(*detector, frame, frames), nchw.fps);
+
+  return 0;
+}
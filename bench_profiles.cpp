@@ -0,0 +1,96 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "face_detector.hpp"
+#include "facenet.hpp"
+#include "inference_context.hpp"
+#include "performance_profile.hpp"
+#include "command_line.hpp"
+#include "benchmark.hpp"
+
+/*
+ * loads the detector and facenet once per performance profile and reports
+ * frames per second and per-inference latency percentiles for each.
+ *
+ *   bench_profiles [device] [--profiles=latency,throughput,balanced]
+ *                  [--frames=200] [--requests=4] [--batch=1]
+ *                  [--width=1920] [--height=1080] [--cpu-threads=0]
+ *
+ * the detector keeps --requests frames in flight, which is what streams
+ * need to help.  facenet runs one synchronous request, so its numbers show
+ * what a profile costs a lone caller.
+ */
+
+static void report(std::string const & profile, std::string const & network, BenchmarkResult const & r) {
+  std::cout << std::setw(12) << profile << std::setw(10) << network
+            << std::fixed << std::setprecision(1)
+            << std::setw(10) << r.fps << " fps"
+            << std::setw(10) << r.p50 << " ms p50"
+            << std::setw(10) << r.p99 << " ms p99" << std::endl;
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+
+  const std::string plugin_name = cmd.positional(0, "CPU");
+  const size_t frames = cmd.get<size_t>("frames", 200);
+  const size_t num_requests = cmd.get<size_t>("requests", 4);
+  const size_t max_batch = cmd.get<size_t>("batch", 1);
+  const int width = cmd.get<int>("width", 1920);
+  const int height = cmd.get<int>("height", 1080);
+
+  std::vector<PerformanceProfile> profiles;
+  std::istringstream names(cmd.get("profiles", "latency,throughput,balanced"));
+  for (std::string name; std::getline(names, name, ',');) {
+    profiles.push_back(parse_performance_profile(name));
+  }
+
+  const std::string plugin_path = "/opt/intel/openvino/deployment_tools/inference_engine/lib/";
+  const std::string model_precision = plugin_name == "MYRIAD" ? "FP16" : "FP32";
+
+  InferenceContextOptions context_options;
+  context_options.plugin_path = plugin_path;
+  context_options.cpu_threads = cmd.get<size_t>("cpu-threads", 0);
+  std::shared_ptr<InferenceContext> context = std::make_shared<InferenceContext>(context_options);
+
+  // a mid grey frame, detections do not matter here
+  std::vector<unsigned char> pixels(3 * width * height, 128);
+  RGB24 frame(pixels.data(), 3 * width, 0, 0, width, height);
+  RGB24 crop = frame.SubImage(Rect{0, 0, 160, 160});
+
+  for (PerformanceProfile profile : profiles) {
+    {
+      DetectorOptions options;
+      options.num_requests = num_requests;
+      options.context = context;
+      options.profile = profile;
+      if (plugin_name != "MYRIAD") {
+        options.input_layout = Layout::NHWC;
+      }
+
+      FaceDetector detector(
+        "../face-detection-model/" + model_precision + "/face-detection-adas-0001.xml",
+        "../face-detection-model/" + model_precision + "/face-detection-adas-0001.bin",
+        plugin_name, plugin_path, options);
+      report(to_string(profile), "detector", benchmark_detector(detector, frame, frames));
+    }
+    {
+      FacenetOptions options;
+      options.max_batch = max_batch;
+      options.context = context;
+      options.profile = profile;
+
+      Facenet facenet(
+        "../resnet50_128_caffe/" + model_precision + "/resnet50_128.xml",
+        "../resnet50_128_caffe/" + model_precision + "/resnet50_128.bin",
+        plugin_name, plugin_path, options);
+      report(to_string(profile), "facenet", benchmark_facenet(facenet, crop, frames));
+    }
+  }
+
+  return 0;
+}
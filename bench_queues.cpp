@@ -0,0 +1,80 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+
+#include "bounded_queue.hpp"
+#include "spsc_ring.hpp"
+#include "mpmc_queue.hpp"
+
+typedef std::chrono::steady_clock Clock;
+
+/*
+ * passes items from producers to consumers through Queue and returns the
+ * throughput in millions of items per second.
+ */
+template<typename Queue>
+double run(size_t producers, size_t consumers, size_t items, size_t capacity) {
+  Queue queue(capacity);
+  std::atomic<size_t> producing(producers);
+  std::atomic<size_t> received(0);
+
+  std::vector<std::thread> threads;
+  Clock::time_point t0 = Clock::now();
+
+  for (size_t p = 0; p < producers; p++) {
+    threads.push_back(std::thread([&, p] {
+      for (size_t i = p; i < items; i += producers) {
+        queue.push(i);
+      }
+      if (--producing == 0) {
+        queue.close();
+      }
+    }));
+  }
+  for (size_t c = 0; c < consumers; c++) {
+    threads.push_back(std::thread([&] {
+      size_t item, n = 0;
+      while (queue.pop(item)) {
+        n++;
+      }
+      received += n;
+    }));
+  }
+  for (auto & t : threads) {
+    t.join();
+  }
+
+  double seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+  if (received != items) {
+    std::cerr << "lost items: " << received << " of " << items << std::endl;
+    std::exit(1);
+  }
+  return items / seconds / 1e6;
+}
+
+void report(std::string const & name, size_t producers, size_t consumers, double mops) {
+  std::cout << std::left << std::setw(16) << name << producers << "P/" << consumers << "C  "
+            << std::fixed << std::setprecision(2) << mops << " Mitems/s" << std::endl;
+}
+
+int main(int ac, char * av[]) {
+  size_t items = ac > 1 ? std::atol(av[1]) : 2000000;
+  size_t capacity = ac > 2 ? std::atol(av[2]) : 64;
+
+  std::cout << items << " items, capacity " << capacity << std::endl;
+
+  report("mutex+condvar", 1, 1, run<BoundedQueue<size_t>>(1, 1, items, capacity));
+  report("spsc ring", 1, 1, run<SpscRing<size_t>>(1, 1, items, capacity));
+  report("mpmc queue", 1, 1, run<MpmcQueue<size_t>>(1, 1, items, capacity));
+
+  size_t n = std::max(2u, std::thread::hardware_concurrency() / 2);
+  report("mutex+condvar", n, n, run<BoundedQueue<size_t>>(n, n, items, capacity));
+  report("mpmc queue", n, n, run<MpmcQueue<size_t>>(n, n, items, capacity));
+
+  return 0;
+}
@@ -16,9 +16,52 @@ detector * detector_create(
   return new FaceDetector(string(networkFile), string(networkWeights), string(deviceName), "");
 }
 
-response * detector_do_inference(detector * f, void * pix, int stride, int x0, int y0, int x1, int y1) {
-  auto req = f->InferRGB(pix, stride, x0, y0, x1, y1);
+detector * detector_create_with_context(
+  const char * networkFile,
+  const char * networkWeights,
+  const char * deviceName,
+  inference_context * context)
+{
+  detector_options opts;
+  detector_options_init(&opts);
+  opts.context = context;
+  return detector_create_with_options(networkFile, networkWeights, deviceName, &opts);
+}
+
+void detector_options_init(detector_options * opts) {
+  opts->zero_copy = 0;
+  opts->num_requests = 1;
+  opts->cache_dir = nullptr;
+  opts->context = nullptr;
+  opts->profile = PROFILE_DEFAULT;
+}
+
+detector * detector_create_with_options(
+  const char * networkFile,
+  const char * networkWeights,
+  const char * deviceName,
+  const detector_options * opts)
+{
+  DetectorOptions options;
+  if (opts != nullptr) {
+    if (opts->zero_copy) {
+      options.input_layout = Layout::NHWC;
+    }
+    if (opts->num_requests > 0) {
+      options.num_requests = opts->num_requests;
+    }
+    if (opts->cache_dir != nullptr) {
+      options.cache_dir = opts->cache_dir;
+    }
+    if (opts->context != nullptr) {
+      options.context = opts->context->context;
+    }
+    options.profile = static_cast<PerformanceProfile>(opts->profile);
+  }
+  return new FaceDetector(string(networkFile), string(networkWeights), string(deviceName), "", options);
+}
 
+static response * make_response(FaceDetector::response & req) {
   detection * dets = new detection[req.proposal.size()];
   transform(req.proposal.begin(), req.proposal.end(), dets, [](Proposal & prop) -> detection {
     return detection{
@@ -29,7 +72,35 @@ response * detector_do_inference(detector * f, void * pix, int stride, int x0, i
     };
   });
 
-  return new response{req.proposal.size(), dets};
+  return new response{req.proposal.size(), dets, (unsigned long)req.frame_id};
+}
+
+response * detector_do_inference(detector * f, void * pix, int stride, int x0, int y0, int x1, int y1) {
+  auto req = f->InferRGB(pix, stride, x0, y0, x1, y1);
+
+  return make_response(req);
+}
+int detector_can_submit(detector * f) {
+  return f->can_submit() ? 1 : 0;
+}
+unsigned long detector_in_flight(detector * f) {
+  return f->in_flight();
+}
+unsigned long detector_submit(detector * f, void * pix, int stride, int x0, int y0, int x1, int y1) {
+  return f->SubmitRGB(pix, stride, x0, y0, x1, y1);
+}
+response * detector_collect(detector * f) {
+  auto req = f->Collect();
+
+  return make_response(req);
+}
+response * detector_do_inference_image(detector * f, pixel_format format, void * data, int width, int height) {
+  auto req = f->InferImage(Image::wrap(static_cast<PixelFormat>(format), (unsigned char *)data, width, height));
+
+  return make_response(req);
+}
+unsigned long detector_submit_image(detector * f, pixel_format format, void * data, int width, int height) {
+  return f->SubmitImage(Image::wrap(static_cast<PixelFormat>(format), (unsigned char *)data, width, height));
 }
 void detector_destroy_response(response * res) {
   // std::clog << "destroying response\n";
@@ -3,6 +3,7 @@
 #include "facenet.hpp"
 
 #include <string>
+#include <vector>
 #include <algorithm>
 #include <iostream>
 
@@ -11,6 +12,41 @@ using std::string;
 facenet * create_classifier(char * networkFile, char * networkWeights, char * deviceName) {
   return new Facenet(string(networkFile), string(networkWeights), string(deviceName), string());
 }
+facenet * create_batch_classifier(char * networkFile, char * networkWeights, char * deviceName, int max_batch) {
+  FacenetOptions options;
+  if (max_batch > 0) {
+    options.max_batch = max_batch;
+  }
+  return new Facenet(string(networkFile), string(networkWeights), string(deviceName), string(), options);
+}
+void classifier_options_init(classifier_options * opts) {
+  opts->max_batch = 1;
+  opts->cache_dir = nullptr;
+  opts->context = nullptr;
+  opts->profile = PROFILE_DEFAULT;
+}
+facenet * create_classifier_with_options(char * networkFile, char * networkWeights, char * deviceName, const classifier_options * opts) {
+  FacenetOptions options;
+  if (opts != nullptr) {
+    if (opts->max_batch > 0) {
+      options.max_batch = opts->max_batch;
+    }
+    if (opts->cache_dir != nullptr) {
+      options.cache_dir = opts->cache_dir;
+    }
+    if (opts->context != nullptr) {
+      options.context = opts->context->context;
+    }
+    options.profile = static_cast<PerformanceProfile>(opts->profile);
+  }
+  return new Facenet(string(networkFile), string(networkWeights), string(deviceName), string(), options);
+}
+facenet * create_classifier_with_context(char * networkFile, char * networkWeights, char * deviceName, inference_context * context) {
+  classifier_options opts;
+  classifier_options_init(&opts);
+  opts.context = context;
+  return create_classifier_with_options(networkFile, networkWeights, deviceName, &opts);
+}
 void destroy_classifier(facenet * c) {
   delete c;
 }
@@ -19,6 +55,11 @@ int classifier_get_embedding_size(facenet * c) {
 
   return c->get_embedding_size();
 }
+int classifier_get_max_batch(facenet * c) {
+  if (c == nullptr) return 0;
+
+  return c->get_max_batch();
+}
 classifier_response * classifier_do_classification(facenet * net, void * data, int stride, int x0, int y0, int x1, int y1) {
   // std::clog << "do_classification\n";
 
@@ -42,3 +83,27 @@ void destroy_classifier_response(classifier_response * r) {
   r->embedding = nullptr;
   delete r;
 }
+classifier_response * classifier_do_batch_classification(facenet * net, classifier_crop * crops, unsigned long count) {
+  std::vector<RGB24> views;
+  views.reserve(count);
+  for (unsigned long i = 0; i < count; i++) {
+    views.push_back(RGB24((unsigned char *)crops[i].data, crops[i].stride, crops[i].x0, crops[i].y0, crops[i].x1, crops[i].y1));
+  }
+
+  auto res = net->InferBatch(views);
+
+  classifier_response * ret = new classifier_response[res.size()];
+  for (size_t i = 0; i < res.size(); i++) {
+    ret[i].embedding = new float[res[i].embedding.size()];
+    ret[i].embedding_size = res[i].embedding.size();
+    ret[i].duration = res[i].duration;
+    std::copy(res[i].embedding.begin(), res[i].embedding.end(), ret[i].embedding);
+  }
+  return ret;
+}
+void destroy_classifier_batch_response(classifier_response * r, unsigned long count) {
+  for (unsigned long i = 0; i < count; i++) {
+    delete [] r[i].embedding;
+  }
+  delete [] r;
+}
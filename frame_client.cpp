@@ -0,0 +1,120 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "command_line.hpp"
+#include "frame_file.hpp"
+#include "frame_protocol.hpp"
+#include "socket_address.hpp"
+
+/*
+ * sends frames to detect_faces --listen, standing in for a camera.
+ *
+ *   frame_client address [capture|-] [--width=1920] [--height=1080]
+ *                [--format=RGB24] [--fps=0] [--frames=100] [--loop]
+ *                [--streams=1]
+ *
+ * frames come from a capture file as test_gst.sh writes it, from stdin for
+ * "-" (e.g. gst-launch-1.0 ... ! fdsink | frame_client tcp:host:9990 -), or
+ * are mid grey when no capture is given.  --streams opens that many
+ * connections, each sending every frame.  --fps=0 sends as fast as the
+ * server takes them.
+ */
+
+static uint64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+  if (cmd.positional_count() < 1) {
+    std::cerr << "usage: frame_client address [capture|-] [--width=1920] [--height=1080] [--format=RGB24]"
+                 " [--fps=0] [--frames=100] [--loop] [--streams=1]" << std::endl;
+    return 1;
+  }
+
+  const SocketAddress address = SocketAddress::parse(cmd.positional(0));
+  const std::string source = cmd.positional(1);
+  const int width = cmd.get<int>("width", 1920);
+  const int height = cmd.get<int>("height", 1080);
+  const PixelFormat format = parse_pixel_format(cmd.get("format", "RGB24"));
+  const double fps = cmd.get<double>("fps", 0);
+  const bool loop = cmd.get("loop", false);
+  const size_t streams = std::max<size_t>(cmd.get<size_t>("streams", 1), 1);
+
+  if (source == "-" && streams > 1) {
+    std::cerr << "stdin can only feed one stream" << std::endl;
+    return 1;
+  }
+
+  std::unique_ptr<FrameFile> file;
+  std::vector<unsigned char> grey;
+  size_t frames = cmd.get<size_t>("frames", 100);
+  if (!source.empty() && source != "-") {
+    file.reset(new FrameFile(source, width, height, format));
+    frames = file->get_frame_count();
+    if (frames == 0) {
+      std::cerr << source << " holds no complete frame" << std::endl;
+      return 1;
+    }
+  } else {
+    grey.assign(image_bytes(format, width, height), 128);
+  }
+
+  auto send_stream = [&](size_t stream) {
+    const FrameHeader prototype(format, width, height, 0);
+    const std::chrono::microseconds interval(fps > 0 ? (long long)(1e6 / fps) : 0);
+    auto due = std::chrono::steady_clock::now();
+
+    size_t sent = 0;
+    int fd = -1;
+    try {
+      fd = address.connect();
+      for (size_t i = 0; source == "-" || i < frames || loop; i++) {
+        const unsigned char * payload = nullptr;
+        if (file) {
+          payload = file->frame(i % frames).planes[0];
+        } else if (source == "-") {
+          if (!std::cin.read((char *)grey.data(), grey.size())) {
+            break;
+          }
+          payload = grey.data();
+        } else {
+          payload = grey.data();
+        }
+
+        if (interval.count() > 0) {
+          std::this_thread::sleep_until(due);
+          due += interval;
+        }
+
+        FrameHeader header = prototype;
+        header.timestamp = now_us();
+        unsigned char encoded[FrameHeader::size];
+        header.encode(encoded);
+        write_fully(fd, encoded, sizeof(encoded));
+        write_fully(fd, payload, header.payload_size);
+        sent++;
+      }
+    } catch (std::exception const & e) {
+      std::cerr << "stream " << stream << ": " << e.what() << std::endl;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    std::clog << "stream " << stream << ": sent " << sent << " frames\n";
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < streams; i++) {
+    threads.emplace_back(send_stream, i);
+  }
+  for (auto & t : threads) {
+    t.join();
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+/*
+ * Backoff is used by the blocking operations of the lock-free queues: it
+ * spins briefly, then yields, so a waiter reacts within nanoseconds under
+ * load.  once pause() returns false the waiter should park on an
+ * EventCount instead of burning a core on an idle queue.
+ */
+class Backoff {
+  unsigned count;
+public:
+  Backoff()
+    : count(0)
+  { }
+
+  /* false once spinning and yielding have run out and it is time to park */
+  bool pause() {
+    if (count < 64) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+      _mm_pause();
+#endif
+    } else if (count < 128) {
+      std::this_thread::yield();
+    } else {
+      return false;
+    }
+    count++;
+    return true;
+  }
+  void reset() {
+    count = 0;
+  }
+};
+
+/*
+ * EventCount lets a thread sleep until a lock-free condition may have
+ * changed, without a lock on the fast path.  a waiter announces itself
+ * with prepare_wait(), checks its condition once more, and then either
+ * calls cancel_wait() or wait() with the key prepare_wait() returned.
+ * whoever changes the condition calls notify() afterwards, which costs a
+ * fence and a load while nobody is waiting.
+ *
+ * a notify() between prepare_wait() and wait() is never lost: it moves the
+ * epoch past the key, and wait() then returns at once.
+ */
+class EventCount {
+  std::atomic<uint32_t> waiters;
+  std::atomic<uint64_t> epoch;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  void signal(bool all) {
+    // orders the caller's change before the load of waiters, against the
+    // fence in prepare_wait
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (all) {
+      cond.notify_all();
+    } else {
+      cond.notify_one();
+    }
+  }
+public:
+  EventCount()
+    : waiters(0), epoch(0)
+  { }
+
+  uint64_t prepare_wait() {
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return epoch.load(std::memory_order_relaxed);
+  }
+  void cancel_wait() {
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+  /* sleeps until a notify() after the prepare_wait() that returned key */
+  void wait(uint64_t key) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this, key] { return epoch.load(std::memory_order_relaxed) != key; });
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+  /* wakes one waiter */
+  void notify() {
+    signal(false);
+  }
+  /* wakes every waiter */
+  void notify_all() {
+    signal(true);
+  }
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "common.hpp"
+#include "image.hpp"
+#include "face_detector.hpp"
+#include "facenet.hpp"
+
+/* measurements shared by bench_profiles, bench_native and autotune */
+
+struct BenchmarkResult {
+  double fps;
+  // per-inference latency in ms
+  double p50;
+  double p99;
+};
+
+static double percentile(std::vector<double> sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  std::sort(sorted.begin(), sorted.end());
+  size_t i = std::min(sorted.size() - 1, (size_t)(p * sorted.size()));
+  return sorted[i];
+}
+
+static BenchmarkResult summarize(std::vector<double> const & latencies, size_t items, std::chrono::steady_clock::time_point t0) {
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  return BenchmarkResult{items / seconds, percentile(latencies, 0.50), percentile(latencies, 0.99)};
+}
+
+/* keeps every request of the detector busy until frames have completed */
+static BenchmarkResult benchmark_detector(FaceDetector & detector, Image const & frame, size_t frames) {
+  // the first inferences pay for lazy initialisation inside the plugin
+  for (size_t i = 0; i < detector.get_num_requests(); i++) {
+    detector.InferImage(frame);
+  }
+
+  std::vector<double> latencies;
+  size_t submitted = 0;
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  while (latencies.size() < frames) {
+    while (submitted < frames && detector.can_submit()) {
+      detector.SubmitImage(frame);
+      submitted++;
+    }
+    latencies.push_back(detector.Collect().duration);
+  }
+  return summarize(latencies, frames, t0);
+}
+
+/* embeds at least crops copies of crop, a full batch per inference */
+static BenchmarkResult benchmark_facenet(Facenet & facenet, RGB24 const & crop, size_t crops) {
+  std::vector<RGB24> batch(facenet.get_max_batch(), crop);
+  facenet.InferBatch(batch);
+
+  std::vector<double> latencies;
+  size_t done = 0;
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  while (done < crops) {
+    std::vector<Facenet::response> res = facenet.InferBatch(batch);
+    latencies.push_back(res.front().duration);
+    done += res.size();
+  }
+  return summarize(latencies, done, t0);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <inference_engine.hpp>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "common.hpp"
+
+/*
+ * BlobPool keeps planar U8 input blobs alive between inferences so the hot
+ * path does not allocate a fresh frame sized buffer on every call.
+ *
+ * Blobs are keyed by (width, height).  Once the pool is full the least
+ * recently used entry is evicted and its storage is handed to the new size,
+ * so frames of a few different sizes settle on a fixed set of buffers that
+ * only ever grow.  A size the pool does not hold wraps that storage in a
+ * new Blob, so it suits inputs whose size repeats, like a camera's frames,
+ * which hit every time and allocate nothing.  Face crops, whose sizes
+ * rarely repeat, are resized into the request's own blob instead, see
+ * Facenet::InferBatch.
+ *
+ * A pool belongs to one InferRequest: a blob returned by acquire() stays
+ * valid until the next call to acquire() with a different size.
+ */
+class BlobPool {
+  struct entry {
+    size_t width;
+    size_t height;
+    size_t capacity;
+    std::shared_ptr<unsigned char> storage;
+    InferenceEngine::Blob::Ptr blob;
+    uint64_t last_used;
+  };
+
+  std::vector<entry> entries;
+  size_t max_entries;
+  size_t channels;
+  uint64_t clock;
+
+  size_t hits;
+  size_t misses;
+  size_t allocations;
+
+  static InferenceEngine::Blob::Ptr wrap(unsigned char * data, size_t channels, size_t width, size_t height) {
+    InferenceEngine::TensorDesc tdesc(InferenceEngine::Precision::U8, {1, channels, height, width}, InferenceEngine::Layout::NCHW);
+    return InferenceEngine::make_shared_blob<unsigned char>(tdesc, data, channels * width * height);
+  }
+public:
+  BlobPool(size_t max_entries = 4, size_t channels = 3)
+    : max_entries(max_entries > 0 ? max_entries : 1), channels(channels), clock(0),
+      hits(0), misses(0), allocations(0)
+  { }
+
+  InferenceEngine::Blob::Ptr acquire(size_t width, size_t height) {
+    clock++;
+
+    entry * lru = nullptr;
+    for (auto & e : entries) {
+      if (e.width == width && e.height == height) {
+        hits++;
+        e.last_used = clock;
+        return e.blob;
+      }
+      if (lru == nullptr || e.last_used < lru->last_used) {
+        lru = &e;
+      }
+    }
+
+    misses++;
+
+    size_t size = channels * width * height;
+
+    entry * e = lru;
+    if (entries.size() < max_entries) {
+      entries.push_back(entry{0, 0, 0, nullptr, nullptr, 0});
+      e = &entries.back();
+    }
+
+    // release the old view before its storage is reused or replaced
+    e->blob.reset();
+    if (e->capacity < size) {
+      e->storage.reset(new unsigned char[size], array_deleter<unsigned char>());
+      e->capacity = size;
+      allocations++;
+    }
+
+    e->width = width;
+    e->height = height;
+    e->last_used = clock;
+    e->blob = wrap(e->storage.get(), channels, width, height);
+    return e->blob;
+  }
+
+  size_t get_hits() const {
+    return hits;
+  }
+  size_t get_misses() const {
+    return misses;
+  }
+  size_t get_allocations() const {
+    return allocations;
+  }
+};
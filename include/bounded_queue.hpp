@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/*
+ * BoundedQueue is a blocking multi-producer/multi-consumer queue holding at
+ * most capacity items.
+ *
+ * close() wakes every waiter: further pushes fail, and pops keep returning
+ * the remaining items until the queue is drained, after which they fail too.
+ */
+template<typename T> class BoundedQueue {
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+public:
+  BoundedQueue(size_t capacity)
+    : capacity(capacity > 0 ? capacity : 1), closed(false)
+  { }
+
+  /* blocks while the queue is full, returns false once the queue is closed */
+  bool push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+    if (closed) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+  }
+  bool try_push(T & item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (closed || items.size() >= capacity) {
+      return false;
+    }
+    items.push_back(std::move(item));
+    lock.unlock();
+    not_empty.notify_one();
+    return true;
+  }
+  /* blocks while the queue is empty, returns false once it is closed and drained */
+  bool pop(T & item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+  }
+  bool try_pop(T & item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    lock.unlock();
+    not_full.notify_one();
+    return true;
+  }
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+  bool is_closed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed;
+  }
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return items.size();
+  }
+  size_t get_capacity() const {
+    return capacity;
+  }
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "common.hpp"
+#include "image.hpp"
+
+/*
+ * BufferPool hands out aligned, reference counted byte buffers.  a buffer
+ * goes back to its pool when the last BufferHandle referring to it is
+ * dropped, so a frame can be shared by the detector, the cropper and the
+ * encoder without copies, and a pipeline in steady state allocates nothing.
+ *
+ * get_allocations() counts every call into the system allocator; once the
+ * pipeline is warm it stops increasing.
+ */
+class BufferPool {
+public:
+  struct stats {
+    size_t allocations;
+    size_t acquires;
+    size_t outstanding;
+    size_t pooled;
+  };
+private:
+  struct state;
+
+  struct block {
+    std::atomic<size_t> refs;
+    size_t capacity;
+    unsigned char * data;
+    std::shared_ptr<state> owner;
+  };
+
+  struct state {
+    size_t alignment;
+    std::mutex mutex;
+    std::vector<block *> available;
+    bool alive;
+    std::atomic<size_t> allocations;
+    std::atomic<size_t> acquires;
+    std::atomic<size_t> outstanding;
+
+    state(size_t alignment)
+      : alignment(alignment), alive(true), allocations(0), acquires(0), outstanding(0)
+    { }
+    ~state() {
+      for (block * b : available) {
+        release_memory(b->data);
+        delete b;
+      }
+    }
+
+    unsigned char * allocate(size_t size) {
+      allocations++;
+#ifdef _WIN32
+      void * p = _aligned_malloc(size, alignment);
+      if (p == nullptr) {
+        throw std::bad_alloc();
+      }
+#else
+      void * p = nullptr;
+      if (posix_memalign(&p, alignment, size) != 0) {
+        throw std::bad_alloc();
+      }
+#endif
+      return static_cast<unsigned char *>(p);
+    }
+    static void release_memory(unsigned char * p) {
+#ifdef _WIN32
+      _aligned_free(p);
+#else
+      std::free(p);
+#endif
+    }
+
+    /* called when the last handle to b goes away */
+    void recycle(block * b) {
+      outstanding--;
+      std::unique_lock<std::mutex> lock(mutex);
+      if (alive) {
+        available.push_back(b);
+        // drop the block's reference last, it may be what keeps this state alive
+        std::shared_ptr<state> keep;
+        keep.swap(b->owner);
+        lock.unlock();
+        return;
+      }
+      lock.unlock();
+      release_memory(b->data);
+      std::shared_ptr<state> keep;
+      keep.swap(b->owner);
+      delete b;
+    }
+  };
+
+  std::shared_ptr<state> pool;
+  size_t default_size;
+public:
+  class Handle {
+    friend class BufferPool;
+    block * b;
+
+    explicit Handle(block * b)
+      : b(b)
+    { }
+    void release() {
+      if (b != nullptr && b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        b->owner->recycle(b);
+      }
+      b = nullptr;
+    }
+  public:
+    Handle()
+      : b(nullptr)
+    { }
+    Handle(Handle const & o)
+      : b(o.b)
+    {
+      if (b != nullptr) {
+        b->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    Handle(Handle && o)
+      : b(o.b)
+    {
+      o.b = nullptr;
+    }
+    Handle & operator=(Handle o) {
+      std::swap(b, o.b);
+      return *this;
+    }
+    ~Handle() {
+      release();
+    }
+    void reset() {
+      release();
+    }
+
+    unsigned char * data() const {
+      return b != nullptr ? b->data : nullptr;
+    }
+    size_t capacity() const {
+      return b != nullptr ? b->capacity : 0;
+    }
+    explicit operator bool() const {
+      return b != nullptr;
+    }
+    /* views the buffer as a tightly packed width x height RGB24 image */
+    RGB24 rgb(int width, int height) const {
+      return RGB24(data(), 3 * width, 0, 0, width, height);
+    }
+    /* views the buffer as a tightly packed width x height image in format */
+    Image image(PixelFormat format, int width, int height) const {
+      return Image::wrap(format, data(), width, height);
+    }
+  };
+
+  BufferPool(size_t default_size = 0, size_t alignment = 64)
+    : pool(std::make_shared<state>(alignment)), default_size(default_size)
+  { }
+  ~BufferPool() {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    // buffers still out are freed instead of recycled once they come back
+    pool->alive = false;
+  }
+  BufferPool(BufferPool const &) = delete;
+  BufferPool & operator=(BufferPool const &) = delete;
+
+  /*
+   * returns a buffer of at least size bytes (the pool's default size when 0).
+   * the smallest free buffer that fits is reused; if none fits, a free buffer
+   * is grown instead, so pools of varying sizes converge on their largest.
+   */
+  Handle acquire(size_t size = 0) {
+    if (size == 0) {
+      size = default_size;
+    }
+
+    block * b = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(pool->mutex);
+      size_t best = pool->available.size();
+      size_t largest = pool->available.size();
+      for (size_t i = 0; i < pool->available.size(); i++) {
+        size_t capacity = pool->available[i]->capacity;
+        if (capacity >= size && (best == pool->available.size() || capacity < pool->available[best]->capacity)) {
+          best = i;
+        }
+        if (largest == pool->available.size() || capacity > pool->available[largest]->capacity) {
+          largest = i;
+        }
+      }
+      size_t pick = best != pool->available.size() ? best : largest;
+      if (pick != pool->available.size()) {
+        b = pool->available[pick];
+        pool->available[pick] = pool->available.back();
+        pool->available.pop_back();
+      }
+    }
+
+    if (b == nullptr) {
+      b = new block();
+      b->capacity = 0;
+      b->data = nullptr;
+    }
+    if (b->capacity < size) {
+      state::release_memory(b->data);
+      b->data = nullptr;
+      b->capacity = 0;
+      b->data = pool->allocate(size);
+      b->capacity = size;
+    }
+
+    b->refs.store(1, std::memory_order_relaxed);
+    b->owner = pool;
+    pool->acquires++;
+    pool->outstanding++;
+    return Handle(b);
+  }
+
+  size_t get_allocations() const {
+    return pool->allocations;
+  }
+  stats get_stats() const {
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    return stats{pool->allocations, pool->acquires, pool->outstanding, pool->available.size()};
+  }
+};
+
+typedef BufferPool::Handle BufferHandle;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+ * CommandLine splits argv into positional arguments and --name=value flags.
+ * a bare --name is stored as "true".
+ */
+class CommandLine {
+  std::map<std::string, std::string> flags;
+  std::vector<std::string> args;
+public:
+  CommandLine(int ac, char * av[]) {
+    for (int i = 1; i < ac; i++) {
+      std::string arg(av[i]);
+      if (arg.compare(0, 2, "--") != 0) {
+        args.push_back(arg);
+        continue;
+      }
+
+      auto eq = arg.find('=');
+      if (eq == std::string::npos) {
+        flags[arg.substr(2)] = "true";
+      } else {
+        flags[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+      }
+    }
+  }
+
+  size_t positional_count() const {
+    return args.size();
+  }
+  std::string positional(size_t i, std::string const & def = std::string()) const {
+    return i < args.size() ? args[i] : def;
+  }
+
+  bool has(std::string const & name) const {
+    return flags.find(name) != flags.end();
+  }
+  std::string get(std::string const & name, std::string const & def) const {
+    auto i = flags.find(name);
+    return i == flags.end() ? def : i->second;
+  }
+  std::string get(std::string const & name, const char * def) const {
+    return get(name, std::string(def));
+  }
+  bool get(std::string const & name, bool def) const {
+    auto i = flags.find(name);
+    if (i == flags.end()) {
+      return def;
+    }
+    return i->second == "true" || i->second == "1" || i->second == "yes";
+  }
+  template<typename T> T get(std::string const & name, T def) const {
+    auto i = flags.find(name);
+    if (i == flags.end()) {
+      return def;
+    }
+
+    std::istringstream ss(i->second);
+    T value;
+    if (!(ss >> value)) {
+      return def;
+    }
+    return value;
+  }
+};
@@ -29,6 +29,28 @@ struct RGB {
   unsigned char r, g, b;
 };
 
+/* half-open pixel rectangle [x0, x1) x [y0, y1), like golang's image.Rectangle */
+struct Rect {
+  int x0, y0, x1, y1;
+
+  inline int dx() const {
+    return x1 - x0;
+  }
+  inline int dy() const {
+    return y1 - y0;
+  }
+  inline bool empty() const {
+    return x0 >= x1 || y0 >= y1;
+  }
+  Rect intersect(Rect const & r) const {
+    Rect ret{std::max(x0, r.x0), std::max(y0, r.y0), std::min(x1, r.x1), std::min(y1, r.y1)};
+    if (ret.empty()) {
+      return Rect{0, 0, 0, 0};
+    }
+    return ret;
+  }
+};
+
 /* class that can hold RGB image data in a format similar to golang's image.Image */
 class RGB24 {
 public:
@@ -59,6 +81,22 @@ public:
   inline int dy() const {
     return y1 - y0;
   }
+  inline Rect bounds() const {
+    return Rect{x0, y0, x1, y1};
+  }
+
+  /*
+   * returns a view of the part of this image inside r.  like golang's
+   * SubImage the view shares the pixels and keeps the original coordinates,
+   * so nothing is copied.
+   */
+  RGB24 SubImage(Rect r) const {
+    r = r.intersect(bounds());
+    if (r.empty()) {
+      return RGB24(nullptr, 0, 0, 0, 0, 0);
+    }
+    return RGB24(pix + pixOffset(r.x0, r.y0), stride, r.x0, r.y0, r.x1, r.y1);
+  }
 
   RGB24(unsigned char * pix, int stride, int x0, int y0, int x1, int y1)
     : pix(pix), stride(stride), x0(x0), y0(y0), x1(x1), y1(y1)
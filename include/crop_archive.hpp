@@ -0,0 +1,546 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* one face as stored in a crop archive */
+struct CropRecord {
+  uint64_t frame_id;
+  // capture time, microseconds since the epoch
+  uint64_t timestamp;
+  uint32_t stream;
+  // face rectangle in frame pixels
+  int32_t x0, y0, x1, y1;
+  float confidence;
+  std::vector<unsigned char> jpeg;
+  std::vector<float> embedding;
+
+  CropRecord()
+    : frame_id(0), timestamp(0), stream(0), x0(0), y0(0), x1(0), y1(0), confidence(0)
+  { }
+};
+
+/*
+ * crop archive segments are append-only files of CropRecords, so that
+ * thousands of faces a minute become sequential writes to one file rather
+ * than thousands of file creations.  all fields are little endian.
+ *
+ *   file header, 16 bytes
+ *     0  8  magic "FACEARC1"
+ *     8  4  version, 1
+ *    12  4  reserved
+ *
+ *   record, 56 byte header followed by its jpeg and embedding, padded to 8
+ *     0  4  magic "FREC"
+ *     4  4  record size including header and padding
+ *     8  8  frame id
+ *    16  8  timestamp
+ *    24  4  stream
+ *    28 16  x0, y0, x1, y1
+ *    44  4  confidence, float
+ *    48  4  jpeg bytes
+ *    52  4  embedding values, floats
+ *
+ *   index, written when the segment is closed
+ *     24 bytes per record: offset, frame id, timestamp
+ *     trailer, 24 bytes: magic "FACEIDX1", index offset, record count
+ *
+ * a segment whose writer died has no index; readers rebuild it by walking
+ * the records and stop at the first incomplete one.
+ */
+namespace crop_archive {
+
+const size_t file_header_size = 16;
+const size_t record_header_size = 56;
+const size_t index_entry_size = 24;
+const size_t trailer_size = 24;
+const uint32_t version = 1;
+
+inline void put(unsigned char * out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = (unsigned char)(value >> (8 * i));
+  }
+}
+inline uint64_t get(unsigned char const * in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= (uint64_t)in[i] << (8 * i);
+  }
+  return value;
+}
+inline void put_float(unsigned char * out, float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, 4);
+  put(out, bits, 4);
+}
+inline float get_float(unsigned char const * in) {
+  uint32_t bits = (uint32_t)get(in, 4);
+  float f;
+  std::memcpy(&f, &bits, 4);
+  return f;
+}
+
+/* where one record starts, as kept in the index */
+struct IndexEntry {
+  uint64_t offset;
+  uint64_t frame_id;
+  uint64_t timestamp;
+};
+
+inline size_t record_size(CropRecord const & r) {
+  size_t n = record_header_size + r.jpeg.size() + 4 * r.embedding.size();
+  return (n + 7) & ~(size_t)7;
+}
+
+/* appends r's encoding to out */
+inline void encode_record(CropRecord const & r, std::vector<unsigned char> & out) {
+  const size_t size = record_size(r);
+  const size_t start = out.size();
+  out.resize(start + size, 0);
+  unsigned char * p = &out[start];
+
+  std::memcpy(p, "FREC", 4);
+  put(p + 4, size, 4);
+  put(p + 8, r.frame_id, 8);
+  put(p + 16, r.timestamp, 8);
+  put(p + 24, r.stream, 4);
+  put(p + 28, (uint32_t)r.x0, 4);
+  put(p + 32, (uint32_t)r.y0, 4);
+  put(p + 36, (uint32_t)r.x1, 4);
+  put(p + 40, (uint32_t)r.y1, 4);
+  put_float(p + 44, r.confidence);
+  put(p + 48, r.jpeg.size(), 4);
+  put(p + 52, r.embedding.size(), 4);
+
+  unsigned char * q = p + record_header_size;
+  std::memcpy(q, r.jpeg.data(), r.jpeg.size());
+  q += r.jpeg.size();
+  for (float f : r.embedding) {
+    put_float(q, f);
+    q += 4;
+  }
+}
+
+}
+
+/*
+ * CropArchive appends records to segments named <dir>/crops-NNNNNN.arc,
+ * numbered on from the highest segment already there.  records are
+ * collected in memory and written with one write() per batch_bytes; a
+ * segment that would grow past segment_bytes is finished with its index
+ * and the next one started.
+ *
+ * with flush_ms set, a thread of its own also writes out any record that
+ * has been batched that long, so a slow stream of faces reaches disk
+ * within flush_ms rather than only once a batch fills up.
+ *
+ * append() may be called from any thread.  the destructor writes what is
+ * left and the index of the last segment.
+ *
+ * a failed write is cut back off the segment, so the file always ends on a
+ * whole record, and the records of that batch are counted as lost.  when
+ * even that fails the segment is abandoned without an index and the next
+ * append starts a new one.
+ */
+class CropArchive {
+public:
+  struct stats {
+    size_t records;
+    size_t bytes;
+    size_t writes;
+    size_t segments;
+    // appended, but lost to a failed write
+    size_t lost;
+  };
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  std::string dir;
+  size_t segment_bytes;
+  size_t batch_bytes;
+  size_t flush_ms;
+
+  std::mutex mutex;
+  int fd;
+  unsigned segment;
+  // bytes in the current segment, written or batched
+  uint64_t size;
+  // bytes of the current segment known to be on disk
+  uint64_t written;
+  std::vector<unsigned char> batch;
+  // when the oldest record in batch was appended
+  Clock::time_point batch_started;
+  std::vector<crop_archive::IndexEntry> index;
+  stats counters;
+
+  std::condition_variable wake;
+  bool closing;
+  std::thread flusher;
+
+  /* writes out every batch that has waited flush_ms, until the destructor */
+  void flush_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!closing) {
+      if (batch.empty() || fd < 0) {
+        wake.wait_for(lock, std::chrono::milliseconds(flush_ms));
+        continue;
+      }
+      const Clock::time_point due = batch_started + std::chrono::milliseconds(flush_ms);
+      if (Clock::now() < due) {
+        wake.wait_until(lock, due);
+        continue;
+      }
+      try {
+        flush_batch();
+      } catch (std::exception const & e) {
+        // the batch is rolled back and counted as lost
+        std::clog << "crop archive: " << e.what() << "\n";
+      }
+    }
+  }
+
+  std::string segment_name(unsigned n) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "crops-%06u.arc", n);
+    return dir + "/" + name;
+  }
+
+  void write_all(unsigned char const * p, size_t n) {
+    while (n > 0) {
+      ssize_t w = ::write(fd, p, n);
+      if (w < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("can't write " + segment_name(segment) + ": " + std::strerror(errno));
+      }
+      p += w;
+      n -= w;
+    }
+    counters.writes++;
+  }
+
+  void flush_batch() {
+    if (batch.empty()) {
+      return;
+    }
+    try {
+      write_all(batch.data(), batch.size());
+    } catch (...) {
+      rollback();
+      throw;
+    }
+    written += batch.size();
+    batch.clear();
+  }
+
+  /* forgets everything past written, on disk and in the index */
+  void rollback() {
+    batch.clear();
+    while (!index.empty() && index.back().offset >= written) {
+      index.pop_back();
+      counters.lost++;
+    }
+    size = written;
+    if (ftruncate(fd, (off_t)written) != 0 || lseek(fd, 0, SEEK_END) != (off_t)written) {
+      abandon_segment();
+    }
+  }
+
+  /* closes the segment without an index, readers rebuild it from the records */
+  void abandon_segment() {
+    std::clog << "crop archive: abandoning " << segment_name(segment) << "\n";
+    ::close(fd);
+    fd = -1;
+    segment++;
+  }
+
+  void open_segment() {
+    while (access(segment_name(segment).c_str(), F_OK) == 0) {
+      segment++;
+    }
+    std::string name = segment_name(segment);
+    fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+      throw std::runtime_error("can't create " + name + ": " + std::strerror(errno));
+    }
+
+    // written straight away, so that a rollback never cuts into the header
+    unsigned char header[crop_archive::file_header_size] = {0};
+    std::memcpy(header, "FACEARC1", 8);
+    crop_archive::put(header + 8, crop_archive::version, 4);
+    try {
+      write_all(header, sizeof(header));
+    } catch (...) {
+      ::close(fd);
+      fd = -1;
+      std::remove(name.c_str());
+      throw;
+    }
+    size = written = sizeof(header);
+    index.clear();
+    counters.segments++;
+  }
+
+  /* writes the index and closes the segment */
+  void close_segment() {
+    if (fd < 0) {
+      return;
+    }
+    const uint64_t index_offset = size;
+    for (auto const & e : index) {
+      unsigned char entry[crop_archive::index_entry_size];
+      crop_archive::put(entry, e.offset, 8);
+      crop_archive::put(entry + 8, e.frame_id, 8);
+      crop_archive::put(entry + 16, e.timestamp, 8);
+      batch.insert(batch.end(), entry, entry + sizeof(entry));
+    }
+    unsigned char trailer[crop_archive::trailer_size];
+    std::memcpy(trailer, "FACEIDX1", 8);
+    crop_archive::put(trailer + 8, index_offset, 8);
+    crop_archive::put(trailer + 16, index.size(), 8);
+    batch.insert(batch.end(), trailer, trailer + sizeof(trailer));
+
+    try {
+      flush_batch();
+    } catch (...) {
+      if (fd >= 0) {
+        // the records before the failed write are intact, only the index is missing
+        abandon_segment();
+      }
+      throw;
+    }
+    ::close(fd);
+    fd = -1;
+    segment++;
+  }
+public:
+  CropArchive(std::string const & dir, size_t segment_bytes = 256 << 20, size_t batch_bytes = 1 << 20,
+              size_t flush_ms = 0)
+    : dir(dir), segment_bytes(segment_bytes), batch_bytes(batch_bytes), flush_ms(flush_ms),
+      fd(-1), segment(0), size(0), written(0), closing(false)
+  {
+    counters = stats{0, 0, 0, 0, 0};
+    batch.reserve(batch_bytes + (64 << 10));
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      throw std::runtime_error("can't create " + dir + ": " + std::strerror(errno));
+    }
+    if (flush_ms > 0) {
+      flusher = std::thread([this] { flush_loop(); });
+    }
+  }
+  ~CropArchive() {
+    if (flusher.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closing = true;
+      }
+      wake.notify_all();
+      flusher.join();
+    }
+    try {
+      std::lock_guard<std::mutex> lock(mutex);
+      close_segment();
+    } catch (std::exception const & e) {
+      std::clog << "crop archive: " << e.what() << "\n";
+    }
+  }
+  CropArchive(CropArchive const &) = delete;
+  CropArchive & operator=(CropArchive const &) = delete;
+
+  void append(CropRecord const & r) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const size_t n = crop_archive::record_size(r);
+    const size_t closing = crop_archive::index_entry_size * (index.size() + 1) + crop_archive::trailer_size;
+    if (fd >= 0 && size + n + closing > segment_bytes && !index.empty()) {
+      close_segment();
+    }
+    if (fd < 0) {
+      open_segment();
+    }
+
+    if (batch.empty()) {
+      batch_started = Clock::now();
+    }
+    index.push_back(crop_archive::IndexEntry{size, r.frame_id, r.timestamp});
+    crop_archive::encode_record(r, batch);
+    size += n;
+    counters.records++;
+    counters.bytes += n;
+
+    if (batch.size() >= batch_bytes) {
+      flush_batch();
+    }
+  }
+
+  /* writes out batched records, the segment stays open */
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd >= 0) {
+      flush_batch();
+    }
+  }
+
+  stats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, CropArchive::stats const & s) {
+  os << "archive records: " << s.records << " bytes: " << s.bytes
+     << " writes: " << s.writes << " segments: " << s.segments << " lost: " << s.lost;
+  return os;
+}
+
+/*
+ * CropArchiveReader opens one segment for random access by record number.
+ * the index comes from the footer, or from walking the records when the
+ * segment was never closed.
+ */
+class CropArchiveReader {
+  std::string filename;
+  FILE * f;
+  uint64_t file_size;
+  std::vector<crop_archive::IndexEntry> index;
+  bool indexed;
+
+  void read_at(uint64_t offset, void * p, size_t n) {
+    if (fseeko(f, (off_t)offset, SEEK_SET) != 0 || std::fread(p, 1, n, f) != n) {
+      throw std::runtime_error(filename + ": short read at " + std::to_string(offset));
+    }
+  }
+
+  bool read_footer() {
+    if (file_size < crop_archive::file_header_size + crop_archive::trailer_size) {
+      return false;
+    }
+    unsigned char trailer[crop_archive::trailer_size];
+    read_at(file_size - sizeof(trailer), trailer, sizeof(trailer));
+    if (std::memcmp(trailer, "FACEIDX1", 8) != 0) {
+      return false;
+    }
+    const uint64_t index_offset = crop_archive::get(trailer + 8, 8);
+    const uint64_t count = crop_archive::get(trailer + 16, 8);
+    if (index_offset + count * crop_archive::index_entry_size + sizeof(trailer) != file_size) {
+      return false;
+    }
+
+    std::vector<unsigned char> raw(count * crop_archive::index_entry_size);
+    if (!raw.empty()) {
+      read_at(index_offset, raw.data(), raw.size());
+    }
+    for (uint64_t i = 0; i < count; i++) {
+      unsigned char const * e = &raw[i * crop_archive::index_entry_size];
+      index.push_back(crop_archive::IndexEntry{crop_archive::get(e, 8), crop_archive::get(e + 8, 8), crop_archive::get(e + 16, 8)});
+    }
+    return true;
+  }
+
+  void scan() {
+    uint64_t offset = crop_archive::file_header_size;
+    unsigned char h[crop_archive::record_header_size];
+    while (offset + sizeof(h) <= file_size) {
+      read_at(offset, h, sizeof(h));
+      const uint64_t n = crop_archive::get(h + 4, 4);
+      if (std::memcmp(h, "FREC", 4) != 0 || n < sizeof(h) || offset + n > file_size) {
+        break;
+      }
+      index.push_back(crop_archive::IndexEntry{offset, crop_archive::get(h + 8, 8), crop_archive::get(h + 16, 8)});
+      offset += n;
+    }
+  }
+public:
+  CropArchiveReader(std::string const & filename)
+    : filename(filename), f(std::fopen(filename.c_str(), "rb")), file_size(0), indexed(false)
+  {
+    if (f == nullptr) {
+      throw std::runtime_error("can't open " + filename + ": " + std::strerror(errno));
+    }
+    fseeko(f, 0, SEEK_END);
+    file_size = ftello(f);
+
+    unsigned char header[crop_archive::file_header_size];
+    if (file_size < sizeof(header)) {
+      std::fclose(f);
+      throw std::runtime_error(filename + " is not a crop archive");
+    }
+    read_at(0, header, sizeof(header));
+    if (std::memcmp(header, "FACEARC1", 8) != 0 || crop_archive::get(header + 8, 4) != crop_archive::version) {
+      std::fclose(f);
+      throw std::runtime_error(filename + " is not a crop archive");
+    }
+
+    indexed = read_footer();
+    if (!indexed) {
+      index.clear();
+      scan();
+    }
+  }
+  ~CropArchiveReader() {
+    std::fclose(f);
+  }
+  CropArchiveReader(CropArchiveReader const &) = delete;
+  CropArchiveReader & operator=(CropArchiveReader const &) = delete;
+
+  size_t size() const {
+    return index.size();
+  }
+  /* false when the index was rebuilt because the segment was never closed */
+  bool has_footer() const {
+    return indexed;
+  }
+  crop_archive::IndexEntry const & entry(size_t i) const {
+    return index.at(i);
+  }
+
+  CropRecord read(size_t i) {
+    const crop_archive::IndexEntry & e = index.at(i);
+    unsigned char h[crop_archive::record_header_size];
+    read_at(e.offset, h, sizeof(h));
+    if (std::memcmp(h, "FREC", 4) != 0) {
+      throw std::runtime_error(filename + ": no record at " + std::to_string(e.offset));
+    }
+
+    CropRecord r;
+    r.frame_id = crop_archive::get(h + 8, 8);
+    r.timestamp = crop_archive::get(h + 16, 8);
+    r.stream = (uint32_t)crop_archive::get(h + 24, 4);
+    r.x0 = (int32_t)crop_archive::get(h + 28, 4);
+    r.y0 = (int32_t)crop_archive::get(h + 32, 4);
+    r.x1 = (int32_t)crop_archive::get(h + 36, 4);
+    r.y1 = (int32_t)crop_archive::get(h + 40, 4);
+    r.confidence = crop_archive::get_float(h + 44);
+    const size_t jpeg_size = crop_archive::get(h + 48, 4);
+    const size_t dims = crop_archive::get(h + 52, 4);
+    if (sizeof(h) + jpeg_size + 4 * dims > crop_archive::get(h + 4, 4)) {
+      throw std::runtime_error(filename + ": corrupt record at " + std::to_string(e.offset));
+    }
+
+    std::vector<unsigned char> payload(jpeg_size + 4 * dims);
+    if (!payload.empty()) {
+      read_at(e.offset + sizeof(h), payload.data(), payload.size());
+    }
+    r.jpeg.assign(payload.begin(), payload.begin() + jpeg_size);
+    r.embedding.resize(dims);
+    for (size_t k = 0; k < dims; k++) {
+      r.embedding[k] = crop_archive::get_float(&payload[jpeg_size + 4 * k]);
+    }
+    return r;
+  }
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image.hpp"
+#include "jpeg_encoder.hpp"
+
+/* what CropWriter::submit does when its queue is full */
+enum class DropPolicy {
+  // wait for room, slowing the caller down to the writers' pace
+  Block = 0,
+  // discard the crop being submitted
+  DropNewest = 1,
+  // discard the longest queued crop to make room
+  DropOldest = 2
+};
+
+inline const char * to_string(DropPolicy policy) {
+  switch (policy) {
+  case DropPolicy::Block: return "block";
+  case DropPolicy::DropNewest: return "drop-newest";
+  case DropPolicy::DropOldest: return "drop-oldest";
+  }
+  return "unknown";
+}
+
+/* accepts the names to_string returns, in any case */
+inline DropPolicy parse_drop_policy(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+  if (name == "block") return DropPolicy::Block;
+  if (name == "drop-newest") return DropPolicy::DropNewest;
+  if (name == "drop-oldest") return DropPolicy::DropOldest;
+  throw std::invalid_argument("unknown drop policy '" + name + "'");
+}
+
+struct CropWriterOptions {
+  size_t threads;
+  // crops waiting for a worker
+  size_t queue_depth;
+  DropPolicy policy;
+  int quality;
+  // crops with a longer side are shrunk to this many pixels, 0 keeps them whole
+  int max_edge;
+
+  CropWriterOptions()
+    : threads(2), queue_depth(64), policy(DropPolicy::Block), quality(90), max_edge(0)
+  { }
+};
+
+/*
+ * CropWriter encodes crops to JPEG on its own pool of workers, so that the
+ * thread finding faces never waits for libjpeg or the disk.  each crop goes
+ * to a file, or to a sink the caller gives, such as a CropArchive.
+ *
+ * submit() queues a view of the crop and returns.  nothing is copied: the
+ * caller passes whatever keeps the pixels alive (the frame, a pooled
+ * buffer) as owner, and it is released once the file is written.  every
+ * worker has its own JpegEncoder and output buffer.
+ *
+ * a full queue blocks submit() or drops a crop, as the DropPolicy says.
+ * a crop that is dropped or fails to encode never reaches its sink; its
+ * lost callback runs instead, so the caller can keep whatever else
+ * belonged to the face.  the destructor writes whatever is still queued.
+ */
+class CropWriter {
+public:
+  struct stats {
+    size_t submitted;
+    size_t written;
+    size_t dropped;
+    size_t failed;
+    // summed over every crop written
+    double encode_ms;
+    double write_ms;
+    size_t queued;
+    size_t max_queued;
+  };
+  // receives a crop's encoded bytes on a worker thread
+  typedef std::function<void(std::vector<unsigned char> const &)> Sink;
+  // told that a crop was dropped or could not be encoded
+  typedef std::function<void()> Lost;
+private:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::chrono::duration<double, std::ratio<1, 1000>> ms;
+
+  struct job {
+    Image crop;
+    std::shared_ptr<void> owner;
+    Sink sink;
+    Lost lost;
+  };
+
+  static void report_lost(job & j) {
+    if (!j.lost) {
+      return;
+    }
+    try {
+      j.lost();
+    } catch (std::exception const & e) {
+      std::clog << "crop writer: " << e.what() << "\n";
+    }
+  }
+
+  CropWriterOptions options;
+
+  std::mutex mutex;
+  std::condition_variable not_empty;
+  std::condition_variable not_full;
+  std::condition_variable idle;
+  std::deque<job> jobs;
+  size_t busy;
+  bool closed;
+  stats counters;
+
+  std::vector<std::thread> workers;
+
+  void work() {
+    JpegEncoder encoder(options.quality);
+    std::vector<unsigned char> buffer;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      not_empty.wait(lock, [this] { return closed || !jobs.empty(); });
+      if (jobs.empty()) {
+        return;
+      }
+      job j = std::move(jobs.front());
+      jobs.pop_front();
+      counters.queued = jobs.size();
+      busy++;
+      lock.unlock();
+      not_full.notify_one();
+
+      bool ok = true;
+      bool encoded = false;
+      double encode_ms = 0, write_ms = 0;
+      try {
+        Clock::time_point t0 = Clock::now();
+        encoder.encode(j.crop, buffer, options.max_edge);
+        encoded = true;
+        // the pixels are no longer needed once encoded
+        j.owner.reset();
+        Clock::time_point t1 = Clock::now();
+
+        j.sink(buffer);
+        encode_ms = std::chrono::duration_cast<ms>(t1 - t0).count();
+        write_ms = std::chrono::duration_cast<ms>(Clock::now() - t1).count();
+      } catch (std::exception const & e) {
+        ok = false;
+        std::clog << "crop writer: " << e.what() << "\n";
+      }
+      if (!encoded) {
+        report_lost(j);
+      }
+
+      lock.lock();
+      busy--;
+      if (ok) {
+        counters.written++;
+        counters.encode_ms += encode_ms;
+        counters.write_ms += write_ms;
+      } else {
+        counters.failed++;
+      }
+      if (jobs.empty() && busy == 0) {
+        idle.notify_all();
+      }
+    }
+  }
+public:
+  CropWriter(CropWriterOptions const & options = CropWriterOptions())
+    : options(options), busy(0), closed(false)
+  {
+    counters = stats{0, 0, 0, 0, 0, 0, 0, 0};
+    this->options.queue_depth = std::max<size_t>(this->options.queue_depth, 1);
+    for (size_t i = 0; i < std::max<size_t>(options.threads, 1); i++) {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+  ~CropWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+    for (auto & t : workers) {
+      t.join();
+    }
+  }
+  CropWriter(CropWriter const &) = delete;
+  CropWriter & operator=(CropWriter const &) = delete;
+
+  /*
+   * queues crop to be encoded and handed to sink.  owner keeps the pixels
+   * crop points into alive until then.  returns false when the crop was
+   * dropped, or the writer is shutting down; lost runs for any crop that
+   * does not reach its sink, on the submitting or the worker thread.
+   */
+  bool submit(Image const & crop, std::shared_ptr<void> owner, Sink sink, Lost lost = Lost()) {
+    job j{crop, std::move(owner), std::move(sink), std::move(lost)};
+    // dropped jobs are reported once the lock is released
+    job evicted;
+    bool queued = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      counters.submitted++;
+
+      bool room = true;
+      if (!closed && jobs.size() >= options.queue_depth) {
+        switch (options.policy) {
+        case DropPolicy::Block:
+          not_full.wait(lock, [this] { return closed || jobs.size() < options.queue_depth; });
+          break;
+        case DropPolicy::DropNewest:
+          room = false;
+          break;
+        case DropPolicy::DropOldest:
+          evicted = std::move(jobs.front());
+          jobs.pop_front();
+          counters.dropped++;
+          break;
+        }
+      }
+
+      if (room && !closed) {
+        jobs.push_back(std::move(j));
+        counters.queued = jobs.size();
+        counters.max_queued = std::max(counters.max_queued, jobs.size());
+        queued = true;
+      } else {
+        counters.dropped++;
+      }
+    }
+
+    report_lost(evicted);
+    if (!queued) {
+      report_lost(j);
+      return false;
+    }
+    not_empty.notify_one();
+    return true;
+  }
+
+  /* queues crop to be written to its own JPEG file */
+  bool submit(Image const & crop, std::shared_ptr<void> owner, std::string const & filename) {
+    return submit(crop, std::move(owner), [filename](std::vector<unsigned char> const & jpeg) {
+      FILE * f = std::fopen(filename.c_str(), "wb");
+      if (f == nullptr) {
+        throw std::runtime_error("can't open " + filename);
+      }
+      size_t written = std::fwrite(jpeg.data(), 1, jpeg.size(), f);
+      if (std::fclose(f) != 0 || written != jpeg.size()) {
+        throw std::runtime_error("can't write " + filename);
+      }
+    });
+  }
+
+  /* waits until every crop submitted so far is written */
+  void flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return jobs.empty() && busy == 0; });
+  }
+
+  stats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, CropWriter::stats const & s) {
+  size_t n = std::max<size_t>(s.written, 1);
+  os << "crops submitted: " << s.submitted << " written: " << s.written
+     << " dropped: " << s.dropped << " failed: " << s.failed
+     << "\n\tcrop encode/write ms avg: " << s.encode_ms / n << "/" << s.write_ms / n
+     << " queued: " << s.queued << " max queued: " << s.max_queued;
+  return os;
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.hpp"
+#include "image.hpp"
+#include "facenet.hpp"
+
+/*
+ * EmbeddingBatcher collects face crops from any number of threads and feeds
+ * them to a single Facenet in batches.  a batch is flushed as soon as it
+ * holds max_batch crops or when the oldest queued crop has waited for
+ * max_delay, whichever comes first.
+ *
+ * the batcher owns all calls into the Facenet it is given, which must not be
+ * used elsewhere while the batcher is alive.  crops may be in any
+ * PixelFormat and are read when their batch runs, so the pixels must stay
+ * valid until the request has completed.
+ *
+ * a failed batch fails every request in it: futures rethrow the error, and
+ * callbacks get it as their exception_ptr, with an empty response.  an
+ * exception escaping a callback is logged and does not affect the others.
+ */
+class EmbeddingBatcher {
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::chrono::duration<double, std::ratio<1, 1000>> ms;
+  // err is set when the crop's batch failed
+  typedef std::function<void(Facenet::response & res, std::exception_ptr err)> callback;
+
+  struct stats {
+    size_t requests;
+    size_t batches;
+    // batch_sizes[n] is the number of batches that held n crops
+    std::vector<size_t> batch_sizes;
+    // time from Submit until the crop's batch started
+    double total_queue_ms;
+    double max_queue_ms;
+    // time spent running batches
+    double busy_ms;
+    // requests whose batch failed
+    size_t failed;
+
+    double mean_batch_size() const {
+      return batches ? (double)requests / batches : 0;
+    }
+    double mean_queue_ms() const {
+      return requests ? total_queue_ms / requests : 0;
+    }
+  };
+private:
+  struct request {
+    Image crop;
+    Clock::time_point enqueued;
+    std::promise<Facenet::response> promise;
+    callback done;
+
+    request(Image const & crop, callback done)
+      : crop(crop), enqueued(Clock::now()), done(done)
+    { }
+  };
+
+  Facenet & facenet;
+  size_t max_batch;
+  Clock::duration max_delay;
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::condition_variable idle;
+  std::deque<std::unique_ptr<request>> queue;
+  bool stopping;
+  // Flush() calls waiting, which run batches without waiting to fill them
+  size_t flushing;
+  bool processing;
+  stats counters;
+
+  std::thread worker;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cond.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        break;
+      }
+
+      // wait for the batch to fill up, but never past the oldest crop's deadline
+      Clock::time_point deadline = queue.front()->enqueued + max_delay;
+      cond.wait_until(lock, deadline, [this] { return stopping || flushing > 0 || queue.size() >= max_batch; });
+
+      std::vector<std::unique_ptr<request>> batch;
+      while (!queue.empty() && batch.size() < max_batch) {
+        batch.push_back(std::move(queue.front()));
+        queue.pop_front();
+      }
+
+      Clock::time_point started = Clock::now();
+      for (auto const & r : batch) {
+        double queued = std::chrono::duration_cast<ms>(started - r->enqueued).count();
+        counters.total_queue_ms += queued;
+        counters.max_queue_ms = std::max(counters.max_queue_ms, queued);
+      }
+      counters.requests += batch.size();
+      counters.batches++;
+      counters.batch_sizes[batch.size()]++;
+
+      processing = true;
+      lock.unlock();
+      bool ok = process(batch);
+      lock.lock();
+      processing = false;
+      counters.busy_ms += std::chrono::duration_cast<ms>(Clock::now() - started).count();
+      if (!ok) {
+        counters.failed += batch.size();
+      }
+      if (queue.empty()) {
+        idle.notify_all();
+      }
+    }
+  }
+
+  static void complete(request & r, Facenet::response & res, std::exception_ptr err) {
+    try {
+      r.done(res, err);
+    } catch (std::exception const & e) {
+      std::clog << "embedding batcher: callback failed: " << e.what() << "\n";
+    } catch (...) {
+      std::clog << "embedding batcher: callback failed\n";
+    }
+  }
+
+  /* runs one batch and completes its requests, false when the batch failed */
+  bool process(std::vector<std::unique_ptr<request>> & batch) {
+    std::vector<Image> crops;
+    crops.reserve(batch.size());
+    for (auto const & r : batch) {
+      crops.push_back(r->crop);
+    }
+
+    std::vector<Facenet::response> res;
+    try {
+      res = facenet.InferBatch(crops);
+    } catch (...) {
+      std::exception_ptr err = std::current_exception();
+      for (auto & r : batch) {
+        if (r->done) {
+          Facenet::response none = Facenet::response();
+          complete(*r, none, err);
+        } else {
+          r->promise.set_exception(err);
+        }
+      }
+      return false;
+    }
+
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (batch[i]->done) {
+        complete(*batch[i], res[i], nullptr);
+      } else {
+        batch[i]->promise.set_value(std::move(res[i]));
+      }
+    }
+    return true;
+  }
+
+  void enqueue(std::unique_ptr<request> r) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopping) {
+        throw std::logic_error("EmbeddingBatcher is shutting down");
+      }
+      queue.push_back(std::move(r));
+    }
+    cond.notify_all();
+  }
+public:
+  EmbeddingBatcher(Facenet & facenet, size_t max_batch = 0, std::chrono::milliseconds max_delay = std::chrono::milliseconds(20))
+    : facenet(facenet),
+      max_batch(max_batch > 0 ? max_batch : facenet.get_max_batch()),
+      max_delay(max_delay),
+      stopping(false), flushing(0), processing(false)
+  {
+    counters.requests = 0;
+    counters.batches = 0;
+    counters.batch_sizes.assign(this->max_batch + 1, 0);
+    counters.total_queue_ms = 0;
+    counters.max_queue_ms = 0;
+    counters.busy_ms = 0;
+    counters.failed = 0;
+
+    worker = std::thread(&EmbeddingBatcher::run, this);
+  }
+  /* flushes every queued crop before returning */
+  ~EmbeddingBatcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cond.notify_all();
+    worker.join();
+  }
+
+  std::future<Facenet::response> Submit(Image const & crop) {
+    std::unique_ptr<request> r(new request(crop, callback()));
+    std::future<Facenet::response> ret = r->promise.get_future();
+    enqueue(std::move(r));
+    return ret;
+  }
+  /* done runs on the batcher's thread and should return quickly */
+  void Submit(Image const & crop, callback done) {
+    enqueue(std::unique_ptr<request>(new request(crop, done)));
+  }
+
+  /* runs every queued crop now, and returns once they have completed */
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushing++;
+    cond.notify_all();
+    idle.wait(lock, [this] { return queue.empty() && !processing; });
+    flushing--;
+  }
+
+  size_t get_max_batch() const {
+    return max_batch;
+  }
+  stats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, EmbeddingBatcher::stats const & s) {
+  os << "requests: " << s.requests << " batches: " << s.batches
+     << " mean batch: " << s.mean_batch_size()
+     << " queue ms mean/max: " << s.mean_queue_ms() << "/" << s.max_queue_ms
+     << " busy ms: " << s.busy_ms << " failed: " << s.failed
+     << " sizes:";
+  for (size_t n = 1; n < s.batch_sizes.size(); n++) {
+    os << " " << n << "=" << s.batch_sizes[n];
+  }
+  return os;
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "crop_archive.hpp"
+#include "float_format.hpp"
+#include "half.hpp"
+
+/* writes embedding as a JSON array */
+inline void write_json_array(std::ostream & os, std::vector<float> const & embedding) {
+  char number[32];
+  os << "[";
+  for (size_t i = 0; i < embedding.size(); i++) {
+    if (i > 0) {
+      os << ", ";
+    }
+    os.write(number, format_float(number, sizeof(number), embedding[i]));
+  }
+  os << "]";
+}
+
+enum class EmbeddingFormat {
+  F32 = 1,
+  F16 = 2,
+  // one JSON object per line, for reading by eye
+  Json = 3
+};
+
+inline const char * to_string(EmbeddingFormat format) {
+  switch (format) {
+  case EmbeddingFormat::F32: return "f32";
+  case EmbeddingFormat::F16: return "f16";
+  case EmbeddingFormat::Json: return "json";
+  }
+  return "unknown";
+}
+
+/* accepts the names to_string returns, in any case */
+inline EmbeddingFormat parse_embedding_format(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+  if (name == "f32") return EmbeddingFormat::F32;
+  if (name == "f16") return EmbeddingFormat::F16;
+  if (name == "json") return EmbeddingFormat::Json;
+  throw std::invalid_argument("unknown embedding format '" + name + "'");
+}
+
+/*
+ * EmbeddingSink streams the embedding of every face, with the face's
+ * CropRecord metadata, to a file, a named pipe or stdout ("-").
+ *
+ * the binary formats start with an 8 byte header, then one record per
+ * face, all little endian:
+ *
+ *   header
+ *     0  4  magic "FEMB"
+ *     4  2  version, 1
+ *     6  2  format, 1 for f32, 2 for f16
+ *
+ *   record
+ *     0  4  bytes that follow this field
+ *     4  8  frame id
+ *    12  8  timestamp
+ *    20  4  stream
+ *    24 16  x0, y0, x1, y1
+ *    40  4  confidence, float
+ *    44  4  embedding values
+ *    48     the values, 4 or 2 bytes each
+ *
+ * f16 halves the output; an embedding survives it to about three decimal
+ * digits, which distance comparisons do not notice.
+ *
+ * records are buffered and written once buffer_bytes have collected when
+ * the target is a file.  pipes and terminals get every record as it is
+ * written, so that whatever reads them sees faces as they are found.
+ * write() may be called from any thread.
+ *
+ * a pipe whose reader has gone (EPIPE) closes the sink rather than failing:
+ * later records are counted as dropped, and is_closed() tells the caller it
+ * can stop producing them.  SIGPIPE must be ignored for write() to see
+ * EPIPE at all.
+ */
+class EmbeddingSink {
+public:
+  struct stats {
+    size_t records;
+    size_t bytes;
+    size_t writes;
+    // written after the reader of the pipe had gone
+    size_t dropped;
+  };
+private:
+  static const size_t header_size = 8;
+  static const size_t record_header_size = 48;
+
+  std::string target;
+  EmbeddingFormat format;
+  size_t buffer_bytes;
+  int fd;
+  bool owned;
+  // the reader closed its end of the pipe
+  bool closed;
+
+  std::mutex mutex;
+  std::vector<unsigned char> buffer;
+  stats counters;
+
+  void flush_buffer() {
+    const unsigned char * p = buffer.data();
+    size_t n = buffer.size();
+    while (n > 0) {
+      ssize_t w = ::write(fd, p, n);
+      if (w < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        buffer.clear();
+        if (errno == EPIPE) {
+          std::clog << "embedding sink: the reader of " << target << " has gone, dropping embeddings\n";
+          closed = true;
+          return;
+        }
+        throw std::runtime_error("can't write " + target + ": " + std::strerror(errno));
+      }
+      p += w;
+      n -= w;
+    }
+    if (!buffer.empty()) {
+      counters.writes++;
+    }
+    buffer.clear();
+  }
+
+  void encode_binary(CropRecord const & r) {
+    const size_t value_size = format == EmbeddingFormat::F16 ? 2 : 4;
+    const size_t size = record_header_size + value_size * r.embedding.size();
+    const size_t start = buffer.size();
+    buffer.resize(start + size);
+    unsigned char * p = &buffer[start];
+
+    crop_archive::put(p, size - 4, 4);
+    crop_archive::put(p + 4, r.frame_id, 8);
+    crop_archive::put(p + 12, r.timestamp, 8);
+    crop_archive::put(p + 20, r.stream, 4);
+    crop_archive::put(p + 24, (uint32_t)r.x0, 4);
+    crop_archive::put(p + 28, (uint32_t)r.y0, 4);
+    crop_archive::put(p + 32, (uint32_t)r.x1, 4);
+    crop_archive::put(p + 36, (uint32_t)r.y1, 4);
+    crop_archive::put_float(p + 40, r.confidence);
+    crop_archive::put(p + 44, r.embedding.size(), 4);
+
+    unsigned char * q = p + record_header_size;
+    if (format == EmbeddingFormat::F16) {
+      static_assert(sizeof(half_float::half) == 2, "half must be 16 bits");
+      for (float f : r.embedding) {
+        half_float::half h = half_float::half_cast<half_float::half, std::round_to_nearest>(f);
+        uint16_t bits;
+        std::memcpy(&bits, &h, 2);
+        crop_archive::put(q, bits, 2);
+        q += 2;
+      }
+    } else {
+      for (float f : r.embedding) {
+        crop_archive::put_float(q, f);
+        q += 4;
+      }
+    }
+  }
+
+  void encode_json(CropRecord const & r) {
+    char line[256];
+    char confidence[32];
+    format_float(confidence, sizeof(confidence), r.confidence);
+    int n = std::snprintf(line, sizeof(line),
+                          "{\"frame\": %llu, \"stream\": %u, \"timestamp\": %llu, \"box\": [%d, %d, %d, %d], "
+                          "\"confidence\": %s, \"embedding\": [",
+                          (unsigned long long)r.frame_id, (unsigned)r.stream, (unsigned long long)r.timestamp,
+                          (int)r.x0, (int)r.y0, (int)r.x1, (int)r.y1, confidence);
+    buffer.insert(buffer.end(), line, line + n);
+    for (size_t i = 0; i < r.embedding.size(); i++) {
+      if (i > 0) {
+        buffer.push_back(',');
+        buffer.push_back(' ');
+      }
+      n = format_float(line, sizeof(line), r.embedding[i]);
+      buffer.insert(buffer.end(), line, line + n);
+    }
+    const char end[] = "]}\n";
+    buffer.insert(buffer.end(), end, end + 3);
+  }
+public:
+  EmbeddingSink(std::string const & target, EmbeddingFormat format = EmbeddingFormat::F32, size_t buffer_bytes = 64 << 10)
+    : target(target), format(format), buffer_bytes(buffer_bytes), fd(STDOUT_FILENO), owned(false), closed(false)
+  {
+    counters = stats{0, 0, 0, 0};
+    if (target != "-") {
+      fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) {
+        throw std::runtime_error("can't open " + target + ": " + std::strerror(errno));
+      }
+      owned = true;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      this->buffer_bytes = 0;
+    }
+    buffer.reserve(this->buffer_bytes + 4096);
+
+    if (format != EmbeddingFormat::Json) {
+      unsigned char header[header_size];
+      std::memcpy(header, "FEMB", 4);
+      crop_archive::put(header + 4, 1, 2);
+      crop_archive::put(header + 6, (uint64_t)format, 2);
+      buffer.insert(buffer.end(), header, header + header_size);
+    }
+  }
+  ~EmbeddingSink() {
+    try {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!closed) {
+        flush_buffer();
+      }
+    } catch (std::exception const & e) {
+      std::clog << "embedding sink: " << e.what() << "\n";
+    }
+    if (owned) {
+      ::close(fd);
+    }
+  }
+  EmbeddingSink(EmbeddingSink const &) = delete;
+  EmbeddingSink & operator=(EmbeddingSink const &) = delete;
+
+  EmbeddingFormat get_format() const {
+    return format;
+  }
+  /* true when writing to stdout, which then carries nothing else */
+  bool is_stdout() const {
+    return !owned;
+  }
+  /* true once the reader has closed the pipe, see the class comment */
+  bool is_closed() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return closed;
+  }
+
+  /* writes r's metadata and embedding; its jpeg is not used */
+  void write(CropRecord const & r) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (closed) {
+      counters.dropped++;
+      return;
+    }
+    const size_t before = buffer.size();
+    if (format == EmbeddingFormat::Json) {
+      encode_json(r);
+    } else {
+      encode_binary(r);
+    }
+    counters.records++;
+    counters.bytes += buffer.size() - before;
+    if (buffer.size() >= buffer_bytes) {
+      flush_buffer();
+    }
+  }
+
+  void flush() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!closed) {
+      flush_buffer();
+    }
+  }
+
+  stats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, EmbeddingSink::stats const & s) {
+  os << "embeddings: " << s.records << " bytes: " << s.bytes << " writes: " << s.writes << " dropped: " << s.dropped;
+  return os;
+}
@@ -5,8 +5,21 @@
 #include <ext_list.hpp>
 #include <chrono>
 #include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <map>
+#include <sstream>
+#include <cstdint>
 
 #include "common.hpp"
+#include "pixel_convert.hpp"
+#include "blob_pool.hpp"
+#include "network_cache.hpp"
+#include "inference_context.hpp"
+#include "performance_profile.hpp"
 
 using std::string;
 using namespace InferenceEngine;
@@ -20,13 +33,93 @@ struct Proposal {
   float ymax;
 };
 
+struct DetectorOptions {
+  /*
+   * NCHW copies every frame into a planar blob.  NHWC declares a packed U8
+   * RGB input and wraps the caller's frame memory as the input blob, so the
+   * plugin's preprocessing reads the frame in place.  In that mode the frame
+   * must stay untouched until InferRGB returns.  Frames in other pixel
+   * formats are converted into a packed buffer owned by the request.
+   */
+  Layout input_layout;
+
+  /*
+   * number of InferRequests that may be in flight at once through
+   * SubmitRGB/Collect.  InferRGB runs one frame at a time, but like
+   * SubmitRGB it takes the requests in turn.
+   */
+  size_t num_requests;
+
+  /*
+   * directory of compiled networks, see NetworkCache.  empty disables
+   * caching, and devices that can't export ignore it.  where it is used the
+   * detector always runs native, resizing and converting frames itself,
+   * and input_layout has no effect.
+   */
+  string cache_dir;
+
+  /*
+   * plugin shared with other networks.  when null the network gets a
+   * plugin of its own, loaded from the constructor's plugin_path.
+   */
+  std::shared_ptr<InferenceContext> context;
+
+  /* CPU streams and thread binding the network is loaded with, see PerformanceProfile */
+  PerformanceProfile profile;
+
+  /* CPU streams, overriding the profile's choice when non-zero */
+  size_t cpu_streams;
+
+  /*
+   * size of the frames that will be submitted, 0 when unknown.  when it is
+   * the network's own input size the detector loads the network without
+   * any plugin preprocessing and converts frames straight into the
+   * request's input blob, whatever input_layout says.  frames of any other
+   * size are then resized by the detector itself.
+   */
+  size_t frame_width;
+  size_t frame_height;
+
+  DetectorOptions()
+    : input_layout(Layout::NCHW), num_requests(1), profile(PerformanceProfile::Default), cpu_streams(0),
+      frame_width(0), frame_height(0)
+  { }
+};
+
 class FaceDetector {
-  ConsoleErrorListener error_listener;
+  typedef std::chrono::high_resolution_clock Time;
+  typedef std::chrono::duration<double, std::ratio<1, 1000>> ms;
+  typedef std::chrono::duration<float> fsec;
+
+  /* one InferRequest together with the input blobs it owns */
+  struct request_slot {
+    InferRequest infer_request;
+    Blob::Ptr imageInput;
+    Blob::Ptr boundInput;
+    BlobPool inputPool;
+    // NHWC mode: packed RGB24 copy of frames that arrive in another format
+    std::vector<unsigned char> packed;
+    uint64_t frame_id;
+    Time::time_point started;
+    Time::time_point finished;
+    bool done;
+  };
+
+  /* shared with the completion callbacks, which run on plugin threads */
+  struct completion {
+    std::mutex mutex;
+    std::condition_variable cond;
+  };
+
+  // declared first so the plugin outlives the networks loaded into it
+  std::shared_ptr<InferenceContext> context;
   InferencePlugin plugin;
   CNNNetwork network;
   ExecutableNetwork executable_network;
-  InferRequest infer_request;
-  Blob::Ptr imageInput;
+  std::shared_ptr<completion> completed;
+  std::vector<std::shared_ptr<request_slot>> slots;
+  uint64_t submitted;
+  uint64_t collected;
 
   string imageInputName;
   string outputName;
@@ -35,10 +128,10 @@ class FaceDetector {
   size_t image_height;
   int maxProposalCount;
   float min_confidence;
-
-  typedef std::chrono::high_resolution_clock Time;
-  typedef std::chrono::duration<double, std::ratio<1, 1000>> ms;
-  typedef std::chrono::duration<float> fsec;
+  bool zero_copy;
+  // frames match the network input, the plugin does no preprocessing
+  bool native;
+  bool from_cache;
 public:
   void set_min_confidence(float min_confidence) {
     this->min_confidence = min_confidence;
@@ -46,32 +139,138 @@ public:
   struct response {
     float duration; // in ms
     std::vector<Proposal> proposal;
+    uint64_t frame_id;
   };
-  FaceDetector() {}
-  ~FaceDetector() {}
-  FaceDetector(string networkFile, string networkWeights, string plugin_name, string plugin_path)
-    : min_confidence(0.75)
+  FaceDetector() : submitted(0), collected(0), native(false), from_cache(false) {}
+  ~FaceDetector() {
+    // the completion callbacks must not outlive the slots they point at
+    while (in_flight() > 0) {
+      try {
+        Collect();
+      } catch (std::exception const &) { }
+    }
+  }
+  FaceDetector(string networkFile, string networkWeights, string plugin_name, string plugin_path,
+               DetectorOptions const & options = DetectorOptions())
+    : completed(std::make_shared<completion>()), submitted(0), collected(0),
+      min_confidence(0.75), zero_copy(options.input_layout == Layout::NHWC), native(false)
   {
-    std::cout << "InferenceEngine: " << GetInferenceEngineVersion() << "\n";
+    std::clog << "InferenceEngine: " << GetInferenceEngineVersion() << "\n";
+
+    std::clog << "FaceDetector('" << networkFile << "', '" << networkWeights << "', '" << plugin_name << "')\n";
+    context = options.context;
+    if (!context) {
+      InferenceContextOptions context_options;
+      context_options.plugin_path = plugin_path;
+      context = std::make_shared<InferenceContext>(context_options);
+    }
+    plugin = context->get_plugin(plugin_name);
+
+    NetworkCache cache(options.cache_dir, plugin_name);
+    std::map<string, string> config;
+    apply_performance_profile(options.profile, options.cpu_streams, plugin_name, config);
+    string cache_key;
+    NetworkCache::metadata meta;
+    if (cache.enabled()) {
+      // cached networks are always compiled native, see NetworkCache
+      cache_key = cache.fingerprint(networkFile, networkWeights, plugin_name, config, "NCHW native");
+    }
 
-    std::cout << "FaceDetector('" << networkFile << "', '" << networkWeights << "', '" << plugin_name << "')\n";
-    plugin = PluginDispatcher({ plugin_path.c_str(), "" }).getPluginByDevice(plugin_name);
-    if (plugin_name == "CPU") {
-      plugin.AddExtension(std::make_shared<Extensions::Cpu::CpuExtensions>());
+    from_cache = cache.Import(plugin, cache_key, config, executable_network, meta);
+    if (from_cache) {
+      imageInputName = meta["input"];
+      outputName = meta["output"];
+      maxProposalCount = std::stoi(meta["max_proposals"]);
+      native = true;
+    } else {
+      readNetwork(networkFile, networkWeights, options, cache.enabled());
+      executable_network = plugin.LoadNetwork(network, config);
+      cache.Export(executable_network, cache_key, NetworkCache::metadata{
+        {"input", imageInputName},
+        {"output", outputName},
+        {"max_proposals", std::to_string(maxProposalCount)}
+      });
+    }
+    if (native) {
+      zero_copy = false;
     }
-    static_cast<InferenceEngine::InferenceEnginePluginPtr>(plugin)->SetLogCallback(error_listener);
 
-    std::cout << "reading network...\n";
+    size_t num_requests = std::max<size_t>(options.num_requests, 1);
+    for (size_t i = 0; i < num_requests; i++) {
+      std::shared_ptr<request_slot> slot = std::make_shared<request_slot>();
+      slot->infer_request = executable_network.CreateInferRequest();
+      slot->imageInput = slot->infer_request.GetBlob(imageInputName);
+      slot->boundInput = slot->imageInput;
+      slot->frame_id = 0;
+      slot->done = false;
+
+      // raw pointers keep the callback from owning the slot it belongs to
+      request_slot * s = slot.get();
+      completion * c = completed.get();
+      slot->infer_request.SetCompletionCallback([s, c] {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        s->finished = Time::now();
+        s->done = true;
+        c->cond.notify_all();
+      });
+
+      slots.push_back(slot);
+    }
+
+    Blob::Ptr imageInput = slots[0]->imageInput;
+    num_channels = imageInput->getTensorDesc().getDims()[1];
+    image_width = imageInput->getTensorDesc().getDims()[3];
+    image_height = imageInput->getTensorDesc().getDims()[2];
+
+    std::clog << "[" << image_width << " " << image_height << "," << num_channels << "] x " << num_requests << " requests, "
+              << to_string(options.profile) << " profile" << (native ? ", native input" : "") << "\n";
+  }
+  size_t get_num_channels() const {
+    return num_channels;
+  }
+  size_t get_image_width() const {
+    return image_width;
+  }
+  size_t get_image_height() const {
+    return image_height;
+  }
+  size_t blobSize() const {
+    return num_channels * image_width * image_height;
+  }
+  const BlobPool & get_input_pool(size_t request = 0) const {
+    return slots[request]->inputPool;
+  }
+  size_t get_num_requests() const {
+    return slots.size();
+  }
+  size_t in_flight() const {
+    return submitted - collected;
+  }
+  bool can_submit() const {
+    return in_flight() < slots.size();
+  }
+  /* true when the compiled network came from the cache instead of the IR */
+  bool loaded_from_cache() const {
+    return from_cache;
+  }
+  /* true when frames go into the input blob without plugin preprocessing, see DetectorOptions::frame_width */
+  bool is_native() const {
+    return native;
+  }
+private:
+  /* reads the IR and configures its input and output, leaving it in network */
+  void readNetwork(string const & networkFile, string const & networkWeights, DetectorOptions const & options, bool cached) {
+    std::clog << "reading network...\n";
     CNNNetReader networkReader;
     networkReader.ReadNetwork(networkFile);
 
-    std::cout << "reading weights...\n";
+    std::clog << "reading weights...\n";
     networkReader.ReadWeights(networkWeights);
 
-    std::cout << "getNetwork()...\n";
+    std::clog << "getNetwork()...\n";
     network = networkReader.getNetwork();
 
-    std::cout << "checking inputs...\n";
+    std::clog << "checking inputs...\n";
 
     InputsDataMap inputsInfo(network.getInputsInfo());
     if (inputsInfo.size() != 1)
@@ -80,19 +279,33 @@ public:
     InputInfo::Ptr inputInfo = inputsInfo.begin()->second;
 
 
-    std::cout << "getting input info...\n";
+    std::clog << "getting input info...\n";
     auto item = inputsInfo.begin();
 
-    if (item->second->getInputData()->getTensorDesc().getDims().size() == 4) {
+    const SizeVector inputDims = item->second->getInputData()->getTensorDesc().getDims();
+    if (inputDims.size() == 4) {
       imageInputName = item->first;
+      // the plugin's preprocessing does not survive the network cache, so
+      // cached networks leave resizing to the host like native frames do
+      native = (options.frame_width == inputDims[3] && options.frame_height == inputDims[2]) || cached;
       item->second->setPrecision(Precision::U8);
-      item->second->setLayout(Layout::NCHW);
-      item->second->getPreProcess().setResizeAlgorithm(RESIZE_BILINEAR);
+      if (native) {
+        // frames are written into the input blob as they are, nothing left for the plugin to do
+        item->second->setLayout(Layout::NCHW);
+        item->second->getPreProcess().setResizeAlgorithm(NO_RESIZE);
+      } else {
+        item->second->setLayout(options.input_layout);
+        item->second->getPreProcess().setResizeAlgorithm(RESIZE_BILINEAR);
+      }
+      if (zero_copy && !native) {
+        // frames are wrapped as-is, so let the plugin swap RGB to BGR
+        item->second->getPreProcess().setColorFormat(ColorFormat::RGB);
+      }
     } else {
       throw std::logic_error("only dimensions of size 4 are allowed");
     }
 
-    std::cout << "getting output info...\n";
+    std::clog << "getting output info...\n";
     OutputsDataMap outputsInfo(network.getOutputsInfo());
     DataPtr outputInfo;
     for (const auto& out : outputsInfo) {
@@ -114,67 +327,50 @@ public:
       throw std::logic_error("Output item should have 7 as a last dimension");
     }
 
-    std::cout << "setting precision...\n";
+    std::clog << "setting precision...\n";
     outputInfo->setPrecision(Precision::FP32);
-    executable_network = plugin.LoadNetwork(network, {});
-    infer_request = executable_network.CreateInferRequest();
-
-    imageInput = infer_request.GetBlob(imageInputName);
-
-    num_channels = imageInput->getTensorDesc().getDims()[1];
-    image_width = imageInput->getTensorDesc().getDims()[3];
-    image_height = imageInput->getTensorDesc().getDims()[2];
-
-    std::clog << "[" << image_width << " " << image_height << "," << num_channels << "]\n";
   }
-  size_t get_num_channels() const {
-    return num_channels;
-  }
-  size_t get_image_width() const {
-    return image_width;
-  }
-  size_t get_image_height() const {
-    return image_height;
-  }
-  size_t blobSize() const {
-    return num_channels * image_width * image_height;
-  }
-  response InferRGB(void * data, int stride, int x0, int y0, int x1, int y1) {
-    return InferRGB(RGB24((unsigned char *)data, stride, x0, y0, x1, y1));
-  }
-  response InferRGB(const RGB24& rgb) {
-    TensorDesc tdesc(Precision::U8, {1, 3, (unsigned long)rgb.dy(), (unsigned long)rgb.dx()}, InferenceEngine::Layout::NCHW);
-    Blob::Ptr blob = make_shared_blob<unsigned char>(tdesc);
-    blob->allocate();
-
-    unsigned char* image = static_cast<unsigned char*>(blob->buffer());
-
-    for(int y = 0; y < rgb.dy(); y++) {
-      for(int x = 0; x < rgb.dx(); x++) {
-        // std::clog << "[ " << x << " " << y << " " << c << " ]\n";
-        RGB col = rgb.at(x + rgb.x0, y + rgb.y0);
-
-        image[0 * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = col.b;
-        image[1 * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = col.g;
-        image[2 * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = col.r;
-
-        // image[c * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = data[y * rgb.dx() * 3 + x * 3 + 3 - c];
-      }
+  /*
+   * frames that already match the network input are written straight into
+   * the request's own input blob, anything else goes through a pooled blob
+   * that the plugin resizes.  SetBlob is only called when the blob changes.
+   */
+  Blob::Ptr bindInput(request_slot & slot, size_t width, size_t height) {
+    Blob::Ptr blob;
+    if (width == image_width && height == image_height) {
+      blob = slot.imageInput;
+    } else {
+      blob = slot.inputPool.acquire(width, height);
     }
 
-    infer_request.SetBlob(imageInputName, blob);
+    bindBlob(slot, blob);
+    return blob;
+  }
+  void bindBlob(request_slot & slot, Blob::Ptr const & blob) {
+    if (blob != slot.boundInput) {
+      slot.infer_request.SetBlob(imageInputName, blob);
+      slot.boundInput = blob;
+    }
+  }
+  /* describes the caller's packed frame as an NHWC blob using the view's stride */
+  static Blob::Ptr wrapNHWC(const RGB24 & rgb) {
+    size_t width = rgb.dx();
+    size_t height = rgb.dy();
+    size_t stride = rgb.stride;
 
-    auto t0 = Time::now();
-    infer_request.Infer();
-    auto t1 = Time::now();
-    fsec fs = t1 - t0;
-    ms d = std::chrono::duration_cast<ms>(fs);
+    BlockingDesc blocking({1, height, width, 3}, {0, 2, 3, 1}, 0, {0, 0, 0, 0}, {height * stride, stride, 3, 1});
+    TensorDesc tdesc(Precision::U8, {1, 3, height, width}, blocking);
 
+    return make_shared_blob<unsigned char>(tdesc, rgb.pix, (height - 1) * stride + width * 3);
+  }
+  response parse(request_slot & slot) {
     response res;
 
+    ms d = std::chrono::duration_cast<ms>(fsec(slot.finished - slot.started));
     res.duration = d.count();
+    res.frame_id = slot.frame_id;
 
-    const Blob::Ptr output_blob = infer_request.GetBlob(outputName);
+    const Blob::Ptr output_blob = slot.infer_request.GetBlob(outputName);
     const float* detection = static_cast<PrecisionTrait<Precision::FP32>::value_type*>(output_blob->buffer());
 
     /* Each detection has image_id that denotes processed image */
@@ -201,4 +397,91 @@ public:
     }
     return res;
   }
+public:
+  /*
+   * starts asynchronous inference of img and returns its frame id.  requires
+   * can_submit(); results come back from Collect() in submission order.  in
+   * NHWC mode an RGB24 frame is read in place and must stay valid until its
+   * result has been collected, otherwise it may be reused on return.
+   */
+  uint64_t SubmitImage(const Image & img) {
+    if (!can_submit()) {
+      throw std::logic_error("all infer requests are in flight, Collect() first");
+    }
+
+    request_slot & slot = *slots[submitted % slots.size()];
+
+    if (native) {
+      // no preprocessing in the plugin, so the frame lands in the input blob at the network's size
+      bindBlob(slot, slot.imageInput);
+      unsigned char * image = static_cast<unsigned char *>(slot.imageInput->buffer());
+      if ((size_t)img.dx() == image_width && (size_t)img.dy() == image_height) {
+        image_to_planar_bgr(img, image);
+      } else {
+        image_resize_to_planar_bgr(img, image, image_width, image_height);
+      }
+    } else if (zero_copy && img.format == PixelFormat::RGB24) {
+      bindBlob(slot, wrapNHWC(img.rgb24()));
+    } else if (zero_copy) {
+      const int width = img.dx();
+      const int height = img.dy();
+      slot.packed.resize(image_bytes(PixelFormat::RGB24, width, height));
+      image_to_rgb24(img, slot.packed.data(), 3 * width);
+      bindBlob(slot, wrapNHWC(RGB24(slot.packed.data(), 3 * width, 0, 0, width, height)));
+    } else {
+      Blob::Ptr blob = bindInput(slot, img.dx(), img.dy());
+
+      unsigned char* image = static_cast<unsigned char*>(blob->buffer());
+
+      image_to_planar_bgr(img, image);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(completed->mutex);
+      slot.done = false;
+    }
+    slot.frame_id = submitted;
+    slot.started = Time::now();
+    slot.infer_request.StartAsync();
+    // only a started request is in flight, a throw above leaves the slot free
+    submitted++;
+
+    return slot.frame_id;
+  }
+  uint64_t SubmitRGB(const RGB24& rgb) {
+    return SubmitImage(Image(rgb));
+  }
+  uint64_t SubmitRGB(void * data, int stride, int x0, int y0, int x1, int y1) {
+    return SubmitRGB(RGB24((unsigned char *)data, stride, x0, y0, x1, y1));
+  }
+  /* blocks until the oldest submitted frame is done and returns its detections */
+  response Collect() {
+    if (in_flight() == 0) {
+      throw std::logic_error("no inference in flight");
+    }
+
+    request_slot & slot = *slots[collected % slots.size()];
+    {
+      std::unique_lock<std::mutex> lock(completed->mutex);
+      completed->cond.wait(lock, [&slot] { return slot.done; });
+    }
+    collected++;
+    // surfaces any error raised by the request
+    slot.infer_request.Wait(IInferRequest::WaitMode::RESULT_READY);
+
+    return parse(slot);
+  }
+  response InferRGB(void * data, int stride, int x0, int y0, int x1, int y1) {
+    return InferRGB(RGB24((unsigned char *)data, stride, x0, y0, x1, y1));
+  }
+  response InferRGB(const RGB24& rgb) {
+    return InferImage(Image(rgb));
+  }
+  response InferImage(const Image & img) {
+    if (in_flight() != 0) {
+      throw std::logic_error("InferImage called with asynchronous requests in flight");
+    }
+    SubmitImage(img);
+    return Collect();
+  }
 };
@@ -1,6 +1,7 @@
 #ifndef __FACE_DETECTOR_H__
 #define __FACE_DETECTOR_H__
 
+#include "inference_context_wrapper.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,17 +20,71 @@ extern "C" {
   struct response_tag {
     unsigned long num_detections;
     detection * detections;
+    unsigned long frame_id;
   };
 
   typedef struct response_tag response;
 
+  /* layout of the frames passed to the *_image calls, see image.hpp */
+  typedef enum pixel_format_tag {
+    PIXEL_FORMAT_RGB24 = 0,
+    PIXEL_FORMAT_BGR24 = 1,
+    PIXEL_FORMAT_I420 = 2,
+    PIXEL_FORMAT_NV12 = 3,
+    PIXEL_FORMAT_GRAY8 = 4
+  } pixel_format;
+
+  struct detector_options_tag {
+    /* non-zero wraps the pixels passed to detector_do_inference instead of copying them */
+    int zero_copy;
+    /* number of frames that may be submitted before one has to be collected */
+    int num_requests;
+    /* directory of compiled networks reused across runs, NULL disables the cache */
+    const char * cache_dir;
+    /* plugins shared with other networks, NULL gives the detector its own */
+    inference_context * context;
+    /* PROFILE_THROUGHPUT wants several requests in flight */
+    performance_profile profile;
+  };
+
+  typedef struct detector_options_tag detector_options;
+
+  void detector_options_init(detector_options * opts);
+
   detector * detector_create(
     const char * networkFile,
     const char * networkWeights,
     const char * deviceName);
 
+  detector * detector_create_with_context(
+    const char * networkFile,
+    const char * networkWeights,
+    const char * deviceName,
+    inference_context * context);
+
+  detector * detector_create_with_options(
+    const char * networkFile,
+    const char * networkWeights,
+    const char * deviceName,
+    const detector_options * opts);
+
   void detector_set_min_confidence(detector * d, float min_confidence);
   response * detector_do_inference(detector * d, void * pix, int stride, int x0, int y0, int x1, int y1);
+  /*
+   * asynchronous inference: detector_submit returns the frame id, and
+   * detector_collect returns responses in submission order.  with zero_copy
+   * the pixels must stay valid until their response has been collected.
+   */
+  int detector_can_submit(detector * d);
+  unsigned long detector_in_flight(detector * d);
+  unsigned long detector_submit(detector * d, void * pix, int stride, int x0, int y0, int x1, int y1);
+  response * detector_collect(detector * d);
+  /*
+   * the same for a tightly packed width x height frame in any pixel_format,
+   * converted straight into the network input without an RGB copy.
+   */
+  response * detector_do_inference_image(detector * d, pixel_format format, void * data, int width, int height);
+  unsigned long detector_submit_image(detector * d, pixel_format format, void * data, int width, int height);
   void detector_destroy_response(response * res);
   void detector_destroy(detector * d);
 
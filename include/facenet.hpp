@@ -1,6 +1,10 @@
 #pragma once
 
 #include "common.hpp"
+#include "pixel_convert.hpp"
+#include "network_cache.hpp"
+#include "inference_context.hpp"
+#include "performance_profile.hpp"
 
 #include <inference_engine.hpp>
 #include <ext_list.hpp>
@@ -15,6 +19,7 @@
 #include <cmath>
 #include <cstdint>
 #include <map>
+#include <stdexcept>
 #include "half.hpp"
 
 using std::string; 
@@ -22,16 +27,54 @@ using half_float::half;
 
 using namespace InferenceEngine;
 
+struct FacenetOptions {
+  /*
+   * number of crops embedded by a single inference in InferBatch.  the
+   * network is loaded with this batch size; on CPU dynamic batching runs
+   * only as many items as there are crops, other devices pad the batch.
+   */
+  size_t max_batch;
+
+  /*
+   * directory of compiled networks, see NetworkCache.  empty disables
+   * caching, and devices that can't export ignore it.
+   */
+  string cache_dir;
+
+  /*
+   * plugin shared with other networks.  when null the network gets a
+   * plugin of its own, loaded from the constructor's plugin_path.
+   */
+  std::shared_ptr<InferenceContext> context;
+
+  /* CPU streams and thread binding the network is loaded with, see PerformanceProfile */
+  PerformanceProfile profile;
+
+  /* CPU streams, overriding the profile's choice when non-zero */
+  size_t cpu_streams;
+
+  FacenetOptions()
+    : max_batch(1), profile(PerformanceProfile::Default), cpu_streams(0)
+  { }
+};
+
 class Facenet {
-  ConsoleErrorListener error_listener;
+  // declared first so the plugin outlives the networks loaded into it
+  std::shared_ptr<InferenceContext> context;
   InferencePlugin plugin;
   CNNNetwork network;
   ExecutableNetwork executable_network;
   InferRequest infer_request;
+  Blob::Ptr imageInput;
 
   string inputImageName;
   string outputName;
   int embedding_size;
+  size_t image_width;
+  size_t image_height;
+  size_t max_batch;
+  bool dynamic_batch;
+  bool from_cache;
   Precision precision;
   Precision outputPrecision;
 public:
@@ -43,24 +86,82 @@ public:
     float duration;
     std::vector<float> embedding;
   };
-  Facenet() {}
-
-  Facenet(string networkFile, string networkWeights, string plugin_name, string plugin_path) {
+  Facenet()
+    : embedding_size(0), image_width(0), image_height(0), max_batch(1), dynamic_batch(false), from_cache(false)
+  { }
+
+  Facenet(string networkFile, string networkWeights, string plugin_name, string plugin_path,
+          FacenetOptions const & options = FacenetOptions())
+    : max_batch(std::max<size_t>(options.max_batch, 1)), dynamic_batch(false), from_cache(false)
+  {
     std::clog << "InferenceEngine: " << GetInferenceEngineVersion() << "\n";
-    plugin = PluginDispatcher({ plugin_path.c_str(), "" }).getPluginByDevice(plugin_name);
-    if (plugin_name == "CPU") {
-      plugin.AddExtension(std::make_shared<Extensions::Cpu::CpuExtensions>());
-    } else if (plugin_name == "MYRIAD") {
-      // plugin.SetConfig({{PluginConfigParams::KEY_VPU_HW_STAGES_OPTIMIZATION, "NO"}});
-      // plugin.SetConfig({{"KEY_VPU_HW_STAGES_OPTIMIZATION", "NO"}});
-      plugin.SetConfig({{"VPU_LOG_LEVEL", "LOG_WARNING"}});
+    context = options.context;
+    if (!context) {
+      InferenceContextOptions context_options;
+      context_options.plugin_path = plugin_path;
+      context = std::make_shared<InferenceContext>(context_options);
+    }
+    plugin = context->get_plugin(plugin_name);
+
+    std::map<string, string> config;
+    apply_performance_profile(options.profile, options.cpu_streams, plugin_name, config);
+    if (max_batch > 1) {
+      if (plugin_name == "CPU") {
+        config[PluginConfigParams::KEY_DYN_BATCH_ENABLED] = PluginConfigParams::YES;
+        dynamic_batch = true;
+      }
+      std::clog << "batch size: " << max_batch << (dynamic_batch ? " (dynamic)" : "") << "\n";
     }
-    static_cast<InferenceEngine::InferenceEnginePluginPtr>(plugin)->SetLogCallback(error_listener);
 
+    NetworkCache cache(options.cache_dir, plugin_name);
+    string cache_key;
+    NetworkCache::metadata meta;
+    if (cache.enabled()) {
+      cache_key = cache.fingerprint(networkFile, networkWeights, plugin_name, config,
+                                    "NCHW no resize batch " + std::to_string(max_batch));
+    }
+
+    from_cache = cache.Import(plugin, cache_key, config, executable_network, meta);
+    if (from_cache) {
+      inputImageName = meta["input"];
+      outputName = meta["output"];
+      embedding_size = std::stoi(meta["embedding_size"]);
+      precision = Precision::U8;
+      outputPrecision = Precision::FP32;
+    } else {
+      readNetwork(networkFile, networkWeights);
+      // executable_network = plugin.LoadNetwork(network, {{"VPU_LOG_LEVEL", "LOG_DEBUG"}});
+      executable_network = plugin.LoadNetwork(network, config);
+      cache.Export(executable_network, cache_key, NetworkCache::metadata{
+        {"input", inputImageName},
+        {"output", outputName},
+        {"embedding_size", std::to_string(embedding_size)}
+      });
+    }
+
+    infer_request = executable_network.CreateInferRequest();
+
+    imageInput = infer_request.GetBlob(inputImageName);
+    image_width = imageInput->getTensorDesc().getDims()[3];
+    image_height = imageInput->getTensorDesc().getDims()[2];
+  }
+  int get_embedding_size() const {
+    return embedding_size;
+  }
+  size_t get_max_batch() const {
+    return max_batch;
+  }
+  /* true when the compiled network came from the cache instead of the IR */
+  bool loaded_from_cache() const {
+    return from_cache;
+  }
+private:
+  /* reads the IR and configures its input and output, leaving it in network */
+  void readNetwork(string const & networkFile, string const & networkWeights) {
     CNNNetReader networkReader;
     networkReader.ReadNetwork(networkFile);
     networkReader.ReadWeights(networkWeights);
-    CNNNetwork network = networkReader.getNetwork();
+    network = networkReader.getNetwork();
 
     InputsDataMap inputsInfo(network.getInputsInfo());
     if (inputsInfo.size() != 1)
@@ -86,7 +187,8 @@ public:
       std::clog << "input precision: " << item->second->getPrecision() << "\n";
       precision = item->second->getPrecision();
       item->second->setLayout(Layout::NCHW);
-      item->second->getPreProcess().setResizeAlgorithm(RESIZE_BILINEAR);
+      // crops are resized on the host into the request's own input blob
+      item->second->getPreProcess().setResizeAlgorithm(NO_RESIZE);
     } else {
       throw std::logic_error("only dimensions of size 4 are allowed");
     }
@@ -122,9 +224,9 @@ public:
     std::clog << "output precision: " << outputInfo->getPrecision() << "\n";
     // outputInfo->setLayout(Layout::NC);
 
-    // executable_network = plugin.LoadNetwork(network, {{"VPU_LOG_LEVEL", "LOG_DEBUG"}});
-    executable_network = plugin.LoadNetwork(network, {});
-    infer_request = executable_network.CreateInferRequest();
+    if (max_batch > 1) {
+      network.setBatchSize(max_batch);
+    }
 
     const SizeVector outputDims = outputInfo->getTensorDesc().getDims();
 
@@ -133,51 +235,70 @@ public:
 
     embedding_size = outputDims[1];
   }
-  int get_embedding_size() const {
-    return embedding_size;
-  }
+public:
   response InferRGB(unsigned char * pix, int stride, int x0, int y0, int x1, int y1) {
     RGB24 rgb(pix, stride, x0, y0, x1, y1);
 
     return InferRGB(rgb);
   }
   response InferRGB(const RGB24 & rgb) {
-    TensorDesc tdesc(precision, {1, 3, (unsigned long)rgb.dy(), (unsigned long)rgb.dx()}, InferenceEngine::Layout::NCHW);
-    Blob::Ptr blob = make_shared_blob<PrecisionTrait<Precision::U8>::value_type>(tdesc);
-    blob->allocate();
-
-    PrecisionTrait<Precision::U8>::value_type* image = static_cast<PrecisionTrait<Precision::U8>::value_type*>(blob->buffer());
-
-    for(int y = 0; y < rgb.dy(); y++) {
-      for(int x = 0; x < rgb.dx(); x++) {
-        // std::clog << "[ " << x << " " << y << " " << c << " ]\n";
-        RGB col = rgb.at(x + rgb.x0, y + rgb.y0);
-
-        image[0 * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = col.b;
-        image[1 * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = col.g;
-        image[2 * rgb.dy() * rgb.dx() + y * rgb.dx() + x] = col.r;
+    return InferImage(Image(rgb));
+  }
+  /* resizes img into the request's input blob, which is never reallocated */
+  response InferImage(const Image & img) {
+    return InferBatch(std::vector<Image>(1, img)).front();
+  }
+  /*
+   * embeds all crops, max_batch at a time.  each crop is resized into its
+   * slot of the request's own input tensor, so a whole frame's faces need
+   * one Infer() per max_batch crops.  every response carries the duration
+   * of the inference it was part of.  throws before any inference when a
+   * crop is empty.
+   */
+  std::vector<response> InferBatch(std::vector<RGB24> const & crops) {
+    return InferBatch(std::vector<Image>(crops.begin(), crops.end()));
+  }
+  std::vector<response> InferBatch(std::vector<Image> const & crops) {
+    for (auto const & crop : crops) {
+      // the resampler reads outside an empty crop
+      if (crop.dx() <= 0 || crop.dy() <= 0) {
+        throw std::invalid_argument("empty face crop");
       }
     }
-    infer_request.SetBlob(inputImageName, blob);
 
-    // std::clog << "performing inference\n";
-    auto t0 = Time::now();
-    infer_request.Infer();
-    auto t1 = Time::now();
-    fsec fs = t1 - t0;
-    ms d = std::chrono::duration_cast<ms>(fs);
+    std::vector<response> ret;
+    ret.reserve(crops.size());
 
-    float duration = d.count();
+    unsigned char * image = static_cast<unsigned char*>(imageInput->buffer());
+    const size_t item_size = 3 * image_width * image_height;
 
-    // std::clog << "getting output blob\n";
-    const Blob::Ptr output_blob = infer_request.GetBlob(outputName);
+    for (size_t first = 0; first < crops.size(); first += max_batch) {
+      size_t n = std::min(max_batch, crops.size() - first);
 
-    const float* embedding = static_cast<PrecisionTrait<Precision::FP32>::value_type*>(output_blob->buffer());
+      for (size_t i = 0; i < n; i++) {
+        image_resize_to_planar_bgr(crops[first + i], image + i * item_size, image_width, image_height);
+      }
+      if (dynamic_batch) {
+        infer_request.SetBatch(n);
+      }
 
-    // std::clog << "returning response\n";
-    return response{
-      duration,
-      std::vector<float>(embedding, embedding + embedding_size)
-    };
+      auto t0 = Time::now();
+      infer_request.Infer();
+      auto t1 = Time::now();
+      fsec fs = t1 - t0;
+      ms d = std::chrono::duration_cast<ms>(fs);
+
+      const Blob::Ptr output_blob = infer_request.GetBlob(outputName);
+      const float* embedding = static_cast<PrecisionTrait<Precision::FP32>::value_type*>(output_blob->buffer());
+
+      for (size_t i = 0; i < n; i++) {
+        const float * e = embedding + i * embedding_size;
+        ret.push_back(response{
+          (float)d.count(),
+          std::vector<float>(e, e + embedding_size)
+        });
+      }
+    }
+    return ret;
   }
 };
@@ -1,6 +1,8 @@
 #ifndef __FACENET_WRAPPER_H__
 #define __FACENET_WRAPPER_H__
 
+#include "inference_context_wrapper.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,18 +15,46 @@ extern "C" {
     unsigned long image_height;
   } classifier_request;
 
+  /* one face crop inside a larger frame, as passed to classifier_do_classification */
+  typedef struct classifier_crop_t {
+    void * data;
+    int stride;
+    int x0, y0, x1, y1;
+  } classifier_crop;
+
   typedef struct classifier_response_t {
     float * embedding;
     unsigned long embedding_size;
     float duration;
   } classifier_response;
 
+  typedef struct classifier_options_t {
+    /* crops embedded by one inference, see classifier_do_batch_classification */
+    int max_batch;
+    /* directory of compiled networks reused across runs, NULL disables the cache */
+    const char * cache_dir;
+    /* plugins shared with other networks, NULL gives the classifier its own */
+    inference_context * context;
+    performance_profile profile;
+  } classifier_options;
+
+  void classifier_options_init(classifier_options * opts);
+
   facenet * create_classifier(char * networkFile, char * networkWeights, char * deviceName);
+  facenet * create_batch_classifier(char * networkFile, char * networkWeights, char * deviceName, int max_batch);
+  facenet * create_classifier_with_context(char * networkFile, char * networkWeights, char * deviceName, inference_context * context);
+  facenet * create_classifier_with_options(char * networkFile, char * networkWeights, char * deviceName, const classifier_options * opts);
   int classifier_get_embedding_size(facenet * c);
+  int classifier_get_max_batch(facenet * c);
   void destroy_classifier(facenet * c);
   classifier_response * classifier_do_classification(facenet * c, void * data, int stride, int x0, int y0, int x1, int y1);
   void destroy_classifier_response(classifier_response * r);
 
+  /* embeds count crops in as few inferences as possible; returns an array of count responses.
+     every crop must be non-empty, x1 > x0 and y1 > y0 */
+  classifier_response * classifier_do_batch_classification(facenet * c, classifier_crop * crops, unsigned long count);
+  void destroy_classifier_batch_response(classifier_response * r, unsigned long count);
+
 #ifdef __cplusplus
 }
 #endif
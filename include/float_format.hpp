@@ -0,0 +1,300 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * shortest round trip formatting of floats, after Ulf Adams' Ryu ("Ryu:
+ * fast float-to-string conversion", PLDI 2018).  the digits come from
+ * integer arithmetic on the float's bits alone, so they are the fewest that
+ * parse back to the same float, ties going to the digits closest to the
+ * exact value, and no formatting or parsing round trip is needed to check.
+ *
+ * only 64 bit multiplies are used, so 32 bit ARM builds run it as well.
+ */
+namespace float_format {
+
+const int pow5_inv_bitcount = 59;
+const int pow5_bitcount = 61;
+
+// ceil(2^(pow5bits(i) - 1 + pow5_inv_bitcount) / 5^i), or one more when exact
+const uint64_t pow5_inv_split[31] = {
+  576460752303423489u, 461168601842738791u, 368934881474191033u, 295147905179352826u,
+  472236648286964522u, 377789318629571618u, 302231454903657294u, 483570327845851670u,
+  386856262276681336u, 309485009821345069u, 495176015714152110u, 396140812571321688u,
+  316912650057057351u, 507060240091291761u, 405648192073033409u, 324518553658426727u,
+  519229685853482763u, 415383748682786211u, 332306998946228969u, 531691198313966350u,
+  425352958651173080u, 340282366920938464u, 544451787073501542u, 435561429658801234u,
+  348449143727040987u, 557518629963265579u, 446014903970612463u, 356811923176489971u,
+  570899077082383953u, 456719261665907162u, 365375409332725730u
+};
+
+// 5^i scaled to pow5_bitcount bits
+const uint64_t pow5_split[47] = {
+  1152921504606846976u, 1441151880758558720u, 1801439850948198400u, 2251799813685248000u,
+  1407374883553280000u, 1759218604441600000u, 2199023255552000000u, 1374389534720000000u,
+  1717986918400000000u, 2147483648000000000u, 1342177280000000000u, 1677721600000000000u,
+  2097152000000000000u, 1310720000000000000u, 1638400000000000000u, 2048000000000000000u,
+  1280000000000000000u, 1600000000000000000u, 2000000000000000000u, 1250000000000000000u,
+  1562500000000000000u, 1953125000000000000u, 1220703125000000000u, 1525878906250000000u,
+  1907348632812500000u, 1192092895507812500u, 1490116119384765625u, 1862645149230957031u,
+  1164153218269348144u, 1455191522836685180u, 1818989403545856475u, 2273736754432320594u,
+  1421085471520200371u, 1776356839400250464u, 2220446049250313080u, 1387778780781445675u,
+  1734723475976807094u, 2168404344971008868u, 1355252715606880542u, 1694065894508600678u,
+  2117582368135750847u, 1323488980084844279u, 1654361225106055349u, 2067951531382569187u,
+  1292469707114105741u, 1615587133892632177u, 2019483917365790221u
+};
+
+/* ceil(log2(5^e)), 1 for e == 0 */
+inline int32_t pow5bits(int32_t e) {
+  return (int32_t)((((uint32_t)e * 1217359) >> 19) + 1);
+}
+/* floor(log10(2^e)) */
+inline uint32_t log10_pow2(int32_t e) {
+  return ((uint32_t)e * 78913) >> 18;
+}
+/* floor(log10(5^e)) */
+inline uint32_t log10_pow5(int32_t e) {
+  return ((uint32_t)e * 732923) >> 20;
+}
+
+inline bool multiple_of_pow5(uint32_t value, uint32_t p) {
+  uint32_t count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count >= p;
+}
+inline bool multiple_of_pow2(uint32_t value, uint32_t p) {
+  return (value & ((1u << p) - 1)) == 0;
+}
+
+/* (m * factor) >> shift, for shift > 32 */
+inline uint32_t mul_shift(uint32_t m, uint64_t factor, int32_t shift) {
+  const uint64_t lo = (uint64_t)m * (uint32_t)factor;
+  const uint64_t hi = (uint64_t)m * (uint32_t)(factor >> 32);
+  return (uint32_t)(((lo >> 32) + hi) >> (shift - 32));
+}
+
+/*
+ * the shortest decimal digits and exponent with digits * 10^exponent
+ * reading back as the finite, nonzero float of the given bits.
+ */
+inline void shortest(uint32_t mantissa, uint32_t exponent, uint32_t & digits, int32_t & exp10) {
+  int32_t e2;
+  uint32_t m2;
+  if (exponent == 0) {
+    e2 = 1 - 127 - 23 - 2;
+    m2 = mantissa;
+  } else {
+    e2 = (int32_t)exponent - 127 - 23 - 2;
+    m2 = (1u << 23) | mantissa;
+  }
+  // round to even: the interval includes its bounds when m2 is even
+  const bool accept_bounds = (m2 & 1) == 0;
+
+  // the float and the halfway points to its neighbours, times 4
+  const uint32_t mv = 4 * m2;
+  const uint32_t mp = 4 * m2 + 2;
+  const uint32_t mm_shift = mantissa != 0 || exponent <= 1;
+  const uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+  // the three in decimal, with e10 shared
+  uint32_t vr, vp, vm;
+  int32_t e10;
+  bool vm_trailing_zeros = false;
+  bool vr_trailing_zeros = false;
+  uint32_t last_removed = 0;
+  if (e2 >= 0) {
+    const uint32_t q = log10_pow2(e2);
+    e10 = (int32_t)q;
+    const int32_t k = pow5_inv_bitcount + pow5bits((int32_t)q) - 1;
+    const int32_t i = -e2 + (int32_t)q + k;
+    vr = mul_shift(mv, pow5_inv_split[q], i);
+    vp = mul_shift(mp, pow5_inv_split[q], i);
+    vm = mul_shift(mm, pow5_inv_split[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      // the loop below removes no digit, but rounding needs the last one
+      const int32_t l = pow5_inv_bitcount + pow5bits((int32_t)(q - 1)) - 1;
+      last_removed = mul_shift(mv, pow5_inv_split[q - 1], -e2 + (int32_t)q - 1 + l) % 10;
+    }
+    if (q <= 9) {
+      // at most one of mp, mv and mm is a multiple of 5
+      if (mv % 5 == 0) {
+        vr_trailing_zeros = multiple_of_pow5(mv, q);
+      } else if (accept_bounds) {
+        vm_trailing_zeros = multiple_of_pow5(mm, q);
+      } else {
+        vp -= multiple_of_pow5(mp, q);
+      }
+    }
+  } else {
+    const uint32_t q = log10_pow5(-e2);
+    e10 = (int32_t)q + e2;
+    const int32_t i = -e2 - (int32_t)q;
+    const int32_t k = pow5bits(i) - pow5_bitcount;
+    int32_t j = (int32_t)q - k;
+    vr = mul_shift(mv, pow5_split[i], j);
+    vp = mul_shift(mp, pow5_split[i], j);
+    vm = mul_shift(mm, pow5_split[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j = (int32_t)q - 1 - (pow5bits(i + 1) - pow5_bitcount);
+      last_removed = mul_shift(mv, pow5_split[i + 1], j) % 10;
+    }
+    if (q <= 1) {
+      // mv = 4 * m2 has at least two trailing zero bits
+      vr_trailing_zeros = true;
+      if (accept_bounds) {
+        vm_trailing_zeros = mm_shift == 1;
+      } else {
+        --vp;
+      }
+    } else if (q < 31) {
+      vr_trailing_zeros = multiple_of_pow2(mv, q - 1);
+    }
+  }
+
+  // drop digits while the interval still holds a shorter number
+  int32_t removed = 0;
+  if (vm_trailing_zeros || vr_trailing_zeros) {
+    while (vp / 10 > vm / 10) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed == 0;
+      last_removed = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vm_trailing_zeros) {
+      while (vm % 10 == 0) {
+        vr_trailing_zeros &= last_removed == 0;
+        last_removed = vr % 10;
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+      // exactly halfway, round to even
+      last_removed = 4;
+    }
+    digits = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      last_removed = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    digits = vr + (vr == vm || last_removed >= 5);
+  }
+  exp10 = e10 + removed;
+}
+
+inline int decimal_length(uint32_t v) {
+  int n = 1;
+  while (v >= 10) {
+    v /= 10;
+    n++;
+  }
+  return n;
+}
+
+}
+
+/*
+ * writes f into buf as the fewest decimal digits that read back as the
+ * same float, e.g. 0.1f as "0.1" rather than "0.100000001".  numbers from
+ * 1e-5 up to 1e9 are written plainly, others as 1.5e-40.  NaN and the
+ * infinities, which JSON has no numbers for, are written as null.
+ *
+ * returns the length, which is at most 15; the result is cut short, like
+ * snprintf's, when buf holds fewer than 16 bytes.
+ */
+inline int format_float(char * buf, size_t size, float f) {
+  uint32_t bits;
+  std::memcpy(&bits, &f, 4);
+  const uint32_t mantissa = bits & ((1u << 23) - 1);
+  const uint32_t exponent = (bits >> 23) & 0xff;
+  const bool negative = (bits >> 31) != 0;
+
+  char out[16];
+  int n = 0;
+  if (exponent == 0xff) {
+    std::memcpy(out, "null", 4);
+    n = 4;
+  } else {
+    if (negative) {
+      out[n++] = '-';
+    }
+    if (exponent == 0 && mantissa == 0) {
+      out[n++] = '0';
+    } else {
+      uint32_t digits;
+      int32_t exp10;
+      float_format::shortest(mantissa, exponent, digits, exp10);
+
+      char d[10];
+      const int length = float_format::decimal_length(digits);
+      for (int i = length - 1; i >= 0; i--) {
+        d[i] = (char)('0' + digits % 10);
+        digits /= 10;
+      }
+      // position of the leading digit, as in d.ddd x 10^point
+      const int32_t point = exp10 + length - 1;
+
+      if (point >= -5 && point < 9) {
+        if (point < 0) {
+          out[n++] = '0';
+          out[n++] = '.';
+          for (int32_t i = -1; i > point; i--) {
+            out[n++] = '0';
+          }
+          std::memcpy(out + n, d, length);
+          n += length;
+        } else if (length <= point + 1) {
+          std::memcpy(out + n, d, length);
+          n += length;
+          for (int32_t i = length; i <= point; i++) {
+            out[n++] = '0';
+          }
+        } else {
+          std::memcpy(out + n, d, point + 1);
+          n += point + 1;
+          out[n++] = '.';
+          std::memcpy(out + n, d + point + 1, length - point - 1);
+          n += length - point - 1;
+        }
+      } else {
+        out[n++] = d[0];
+        if (length > 1) {
+          out[n++] = '.';
+          std::memcpy(out + n, d + 1, length - 1);
+          n += length - 1;
+        }
+        out[n++] = 'e';
+        int32_t e = point;
+        if (e < 0) {
+          out[n++] = '-';
+          e = -e;
+        }
+        if (e >= 10) {
+          out[n++] = (char)('0' + e / 10);
+        }
+        out[n++] = (char)('0' + e % 10);
+      }
+    }
+  }
+
+  if (size > 0) {
+    const size_t copied = (size_t)n < size ? (size_t)n : size - 1;
+    std::memcpy(buf, out, copied);
+    buf[copied] = 0;
+  }
+  return n;
+}
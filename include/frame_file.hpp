@@ -0,0 +1,136 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "image.hpp"
+
+/* frames [first, last) of a FrameFile */
+struct FrameRange {
+  size_t first;
+  size_t last;
+
+  size_t size() const {
+    return last - first;
+  }
+};
+
+/*
+ * FrameFile maps a file of back to back raw frames in one PixelFormat, such
+ * as the captures test_gst.sh writes, and hands out Image views straight
+ * into the mapping.  nothing is copied: the kernel pages frames in as they are
+ * touched, and prefetch() asks it to start reading ahead of that.
+ *
+ * views stay valid for the lifetime of the FrameFile.  a trailing partial
+ * frame is ignored.
+ */
+class FrameFile {
+  PixelFormat format;
+  int width;
+  int height;
+  size_t frame_size;
+  size_t frames;
+  size_t length;
+  unsigned char * data;
+
+  static std::runtime_error error(std::string const & what, std::string const & filename) {
+    return std::runtime_error(what + " " + filename + ": " + std::strerror(errno));
+  }
+public:
+  FrameFile(std::string const & filename, int width, int height, PixelFormat format = PixelFormat::RGB24)
+    : format(format), width(width), height(height), frame_size(image_bytes(format, width, height)),
+      frames(0), length(0), data(nullptr)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw error("can't open", filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw error("can't stat", filename);
+    }
+    length = st.st_size;
+    frames = frame_size > 0 ? length / frame_size : 0;
+    if (frames * frame_size != length) {
+      std::clog << filename << ": ignoring " << length - frames * frame_size << " trailing bytes\n";
+    }
+
+    if (length > 0) {
+      void * p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw error("can't map", filename);
+      }
+      data = static_cast<unsigned char *>(p);
+      madvise(data, length, MADV_SEQUENTIAL);
+    }
+    // the mapping keeps the file open
+    close(fd);
+  }
+  ~FrameFile() {
+    if (data != nullptr) {
+      munmap(data, length);
+    }
+  }
+  FrameFile(FrameFile const &) = delete;
+  FrameFile & operator=(FrameFile const &) = delete;
+
+  size_t get_frame_count() const {
+    return frames;
+  }
+  size_t get_frame_size() const {
+    return frame_size;
+  }
+
+  /* a read-only view of frame i, the pixels must not be written to */
+  Image frame(size_t i) const {
+    if (i >= frames) {
+      throw std::out_of_range("frame " + std::to_string(i) + " of " + std::to_string(frames));
+    }
+    return Image::wrap(format, data + i * frame_size, width, height);
+  }
+
+  /* starts reading frames [first, first + count) in the background */
+  void prefetch(size_t first, size_t count) const {
+    if (first >= frames) {
+      return;
+    }
+    count = std::min(count, frames - first);
+
+    // madvise wants a page aligned start
+    static const size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = first * frame_size;
+    size_t aligned = begin - begin % page;
+    madvise(data + aligned, begin - aligned + count * frame_size, MADV_WILLNEED);
+  }
+
+  /*
+   * splits the file into parts contiguous ranges of nearly equal size, so
+   * that independent workers can each process one.
+   */
+  std::vector<FrameRange> split(size_t parts) const {
+    parts = std::max<size_t>(parts, 1);
+
+    std::vector<FrameRange> ret;
+    size_t first = 0;
+    for (size_t i = 0; i < parts; i++) {
+      size_t last = frames * (i + 1) / parts;
+      ret.push_back(FrameRange{first, last});
+      first = last;
+    }
+    return ret;
+  }
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "image.hpp"
+
+/*
+ * wire format of the frame server: every frame is a fixed 32 byte header
+ * followed by its payload, one tightly packed frame as FrameFile reads them.
+ * all fields are little endian.
+ *
+ *   offset  size
+ *        0     4  magic "FRM1"
+ *        4     2  header version, 1
+ *        6     2  PixelFormat
+ *        8     4  width
+ *       12     4  height
+ *       16     8  capture timestamp, microseconds, producer's clock
+ *       24     4  payload size, image_bytes(format, width, height)
+ *       28     4  reserved, 0
+ *
+ * the payload size is redundant on purpose: a receiver that finds anything
+ * but the expected magic and size knows the stream is out of step and drops
+ * the connection rather than misreading every later frame.
+ */
+struct FrameHeader {
+  static const size_t size = 32;
+  static const uint16_t current_version = 1;
+
+  PixelFormat format;
+  int width;
+  int height;
+  uint64_t timestamp;
+  uint32_t payload_size;
+
+  FrameHeader()
+    : format(PixelFormat::RGB24), width(0), height(0), timestamp(0), payload_size(0)
+  { }
+  FrameHeader(PixelFormat format, int width, int height, uint64_t timestamp)
+    : format(format), width(width), height(height), timestamp(timestamp),
+      payload_size((uint32_t)image_bytes(format, width, height))
+  { }
+
+  void encode(unsigned char * out) const {
+    std::memcpy(out, "FRM1", 4);
+    put(out + 4, current_version, 2);
+    put(out + 6, (uint64_t)format, 2);
+    put(out + 8, (uint32_t)width, 4);
+    put(out + 12, (uint32_t)height, 4);
+    put(out + 16, timestamp, 8);
+    put(out + 24, payload_size, 4);
+    put(out + 28, 0, 4);
+  }
+
+  /* throws std::runtime_error when in is not a header this version understands */
+  static FrameHeader decode(unsigned char const * in) {
+    if (std::memcmp(in, "FRM1", 4) != 0) {
+      throw std::runtime_error("bad frame magic");
+    }
+    uint64_t version = get(in + 4, 2);
+    if (version != current_version) {
+      throw std::runtime_error("unsupported frame header version " + std::to_string(version));
+    }
+    uint64_t format = get(in + 6, 2);
+    if (format > (uint64_t)PixelFormat::GRAY8) {
+      throw std::runtime_error("unknown pixel format " + std::to_string(format));
+    }
+
+    FrameHeader ret;
+    ret.format = (PixelFormat)format;
+    ret.width = (int)get(in + 8, 4);
+    ret.height = (int)get(in + 12, 4);
+    ret.timestamp = get(in + 16, 8);
+    ret.payload_size = (uint32_t)get(in + 24, 4);
+    if (ret.width <= 0 || ret.height <= 0 || ret.width > 16384 || ret.height > 16384) {
+      throw std::runtime_error("bad frame size " + std::to_string(ret.width) + "x" + std::to_string(ret.height));
+    }
+    if (ret.payload_size != image_bytes(ret.format, ret.width, ret.height)) {
+      throw std::runtime_error("payload size " + std::to_string(ret.payload_size) + " does not match the frame");
+    }
+    return ret;
+  }
+private:
+  static void put(unsigned char * out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+      out[i] = (unsigned char)(value >> (8 * i));
+    }
+  }
+  static uint64_t get(unsigned char const * in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+  }
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "image.hpp"
+#include "buffer_pool.hpp"
+#include "bounded_queue.hpp"
+#include "frame_protocol.hpp"
+#include "socket_address.hpp"
+
+/* one frame as it came off a producer connection */
+struct ReceivedFrame {
+  // connections are numbered from 0 in the order they were accepted
+  uint32_t stream;
+  // position of the frame within its stream
+  uint64_t sequence;
+  // the producer's capture timestamp, see FrameHeader
+  uint64_t timestamp;
+  BufferHandle data;
+  Image image;
+
+  ReceivedFrame()
+    : stream(0), sequence(0), timestamp(0)
+  { }
+};
+
+struct FrameServerOptions {
+  // see SocketAddress
+  std::string address;
+  // producers connected at once, further connections are refused
+  size_t max_connections;
+  // received frames waiting for next(), a full queue stops reading from the sockets
+  size_t queue_depth;
+  // end the stream once every producer has disconnected, rather than waiting for more
+  bool exit_when_idle;
+  // how long exit_when_idle waits without producers, so one that reconnects
+  // straight away is not cut off
+  int idle_grace_ms;
+  // largest payload accepted, a producer sending more is dropped before any
+  // buffer is allocated, so a peer cannot grow the frame pool at will
+  size_t max_frame_bytes;
+
+  FrameServerOptions()
+    : max_connections(8), queue_depth(8), exit_when_idle(false), idle_grace_ms(2000),
+      max_frame_bytes(image_bytes(PixelFormat::RGB24, 1920, 1080))
+  { }
+};
+
+/*
+ * FrameServer accepts producer connections on a TCP or Unix domain socket
+ * and receives frames framed as in frame_protocol.hpp, each connection on
+ * its own thread and each frame straight into a buffer from the pool.  the
+ * frames of every connection are merged into one queue that next() reads.
+ *
+ * a connection that sends a malformed header is dropped, the others carry
+ * on.  producers are throttled by TCP flow control when the queue is full.
+ */
+class FrameServer {
+public:
+  struct stats {
+    size_t connections;
+    size_t refused;
+    size_t active;
+    size_t frames;
+    size_t bytes;
+    size_t errors;
+  };
+private:
+  struct connection {
+    int fd;
+    uint32_t stream;
+    std::thread thread;
+    std::atomic<bool> done;
+
+    connection(int fd, uint32_t stream)
+      : fd(fd), stream(stream), done(false)
+    { }
+  };
+
+  FrameServerOptions options;
+  SocketAddress address;
+  BufferPool & pool;
+  BoundedQueue<ReceivedFrame> queue;
+
+  int listen_fd;
+  // written to wake the accept loop
+  int wake[2];
+  std::thread acceptor;
+
+  std::mutex mutex;
+  std::list<std::unique_ptr<connection>> connections;
+  bool stopping;
+
+  std::atomic<size_t> accepted;
+  std::atomic<size_t> refused;
+  std::atomic<size_t> active;
+  std::atomic<size_t> frames;
+  std::atomic<size_t> bytes;
+  std::atomic<size_t> errors;
+
+  void notify() {
+    char c = 0;
+    if (write(wake[1], &c, 1) < 0) {
+      // the pipe is full, the accept loop has wake ups pending already
+    }
+  }
+
+  void receive(connection * c) {
+    uint64_t sequence = 0;
+    try {
+      unsigned char header[FrameHeader::size];
+      while (read_fully(c->fd, header, sizeof(header))) {
+        FrameHeader h = FrameHeader::decode(header);
+        if (h.payload_size > options.max_frame_bytes) {
+          throw std::runtime_error(std::to_string(h.width) + "x" + std::to_string(h.height) + " frame exceeds the "
+                                   + std::to_string(options.max_frame_bytes) + " byte limit");
+        }
+
+        ReceivedFrame frame;
+        frame.stream = c->stream;
+        frame.sequence = sequence++;
+        frame.timestamp = h.timestamp;
+        frame.data = pool.acquire(h.payload_size);
+        if (!read_fully(c->fd, frame.data.data(), h.payload_size)) {
+          throw std::runtime_error("connection closed mid frame");
+        }
+        frame.image = frame.data.image(h.format, h.width, h.height);
+
+        frames++;
+        bytes += FrameHeader::size + h.payload_size;
+        if (!queue.push(std::move(frame))) {
+          break;
+        }
+      }
+    } catch (std::exception const & e) {
+      errors++;
+      std::clog << "stream " << c->stream << ": " << e.what() << ", dropping the connection\n";
+    }
+
+    {
+      // stop() must not shut down a descriptor that has been closed and reused
+      std::lock_guard<std::mutex> lock(mutex);
+      close(c->fd);
+      c->done = true;
+    }
+    active--;
+    notify();
+  }
+
+  /* joins connections that have finished */
+  void reap() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto i = connections.begin(); i != connections.end();) {
+      if ((*i)->done) {
+        (*i)->thread.join();
+        i = connections.erase(i);
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  void accept_loop() {
+    typedef std::chrono::steady_clock Clock;
+    bool idle = false;
+    Clock::time_point idle_since;
+
+    while (true) {
+      int timeout = -1;
+      if (idle) {
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - idle_since);
+        timeout = std::max(0, options.idle_grace_ms - (int)waited.count());
+      }
+      pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake[0], POLLIN, 0}};
+      if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+        break;
+      }
+      if (fds[1].revents & POLLIN) {
+        char drain[64];
+        if (read(wake[0], drain, sizeof(drain)) < 0) {
+          // nothing to drain
+        }
+      }
+      reap();
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+          break;
+        }
+        if (options.exit_when_idle && accepted > 0 && connections.empty()) {
+          if (!idle) {
+            idle = true;
+            idle_since = Clock::now();
+          } else if (!(fds[0].revents & POLLIN) && Clock::now() - idle_since >= std::chrono::milliseconds(options.idle_grace_ms)) {
+            std::clog << "every producer has disconnected\n";
+            break;
+          }
+        } else {
+          idle = false;
+        }
+      }
+
+      if (!(fds[0].revents & POLLIN)) {
+        continue;
+      }
+      int fd = accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) {
+        continue;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopping) {
+        // stop() has already shut down every connection it knew about
+        close(fd);
+        break;
+      }
+      if (connections.size() >= options.max_connections) {
+        refused++;
+        close(fd);
+        continue;
+      }
+      uint32_t stream = (uint32_t)accepted++;
+      active++;
+      idle = false;
+      connections.emplace_back(new connection(fd, stream));
+      connection * c = connections.back().get();
+      c->thread = std::thread([this, c] { receive(c); });
+      std::clog << "stream " << stream << " connected\n";
+    }
+
+    // no more frames, next() returns what is queued and then false
+    queue.close();
+  }
+public:
+  FrameServer(FrameServerOptions const & options, BufferPool & pool)
+    : options(options), address(SocketAddress::parse(options.address)), pool(pool),
+      queue(options.queue_depth), listen_fd(address.listen()), stopping(false),
+      accepted(0), refused(0), active(0), frames(0), bytes(0), errors(0)
+  {
+    if (pipe(wake) != 0) {
+      close(listen_fd);
+      throw std::runtime_error("can't create the frame server's wake pipe");
+    }
+    std::clog << "listening for frames on " << address.to_string() << "\n";
+    acceptor = std::thread([this] { accept_loop(); });
+  }
+  ~FrameServer() {
+    stop();
+    acceptor.join();
+    for (auto & c : connections) {
+      c->thread.join();
+    }
+    close(listen_fd);
+    close(wake[0]);
+    close(wake[1]);
+    if (address.local) {
+      unlink(address.path.c_str());
+    }
+  }
+  FrameServer(FrameServer const &) = delete;
+  FrameServer & operator=(FrameServer const &) = delete;
+
+  /* waits for the next frame from any producer, returns false once the server has stopped */
+  bool next(ReceivedFrame & frame) {
+    return queue.pop(frame);
+  }
+
+  /* stops accepting, drops every connection and ends the stream next() reads */
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopping) {
+        return;
+      }
+      stopping = true;
+      for (auto & c : connections) {
+        if (!c->done) {
+          shutdown(c->fd, SHUT_RDWR);
+        }
+      }
+    }
+    queue.close();
+    notify();
+  }
+
+  stats get_stats() const {
+    return stats{accepted, refused, active, frames, bytes, errors};
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, FrameServer::stats const & s) {
+  os << "connections: " << s.connections << " refused: " << s.refused << " active: " << s.active
+     << " frames: " << s.frames << " bytes: " << s.bytes << " errors: " << s.errors;
+  return os;
+}
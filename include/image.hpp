@@ -0,0 +1,239 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "common.hpp"
+
+/*
+ * pixel layouts frames can arrive in.
+ *
+ *   RGB24, BGR24  packed, 3 bytes per pixel
+ *   I420          Y plane, then U and V planes at half width and height
+ *   NV12          Y plane, then one plane of interleaved U,V pairs at half
+ *                 width and height
+ *   GRAY8         Y plane only
+ *
+ * the values match the C API's pixel_format.
+ */
+enum class PixelFormat {
+  RGB24 = 0,
+  BGR24 = 1,
+  I420 = 2,
+  NV12 = 3,
+  GRAY8 = 4
+};
+
+inline const char * to_string(PixelFormat format) {
+  switch (format) {
+  case PixelFormat::RGB24: return "RGB24";
+  case PixelFormat::BGR24: return "BGR24";
+  case PixelFormat::I420: return "I420";
+  case PixelFormat::NV12: return "NV12";
+  case PixelFormat::GRAY8: return "GRAY8";
+  }
+  return "unknown";
+}
+
+/* accepts the names to_string returns in any case */
+inline PixelFormat parse_pixel_format(std::string name) {
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::toupper(c); });
+  if (name == "RGB24" || name == "RGB") return PixelFormat::RGB24;
+  if (name == "BGR24" || name == "BGR") return PixelFormat::BGR24;
+  if (name == "I420" || name == "YUV420P") return PixelFormat::I420;
+  if (name == "NV12") return PixelFormat::NV12;
+  if (name == "GRAY8" || name == "GRAY") return PixelFormat::GRAY8;
+  throw std::invalid_argument("unknown pixel format '" + name + "'");
+}
+
+/* true for the formats whose chroma has half the resolution of their luma */
+inline bool is_subsampled(PixelFormat format) {
+  return format == PixelFormat::I420 || format == PixelFormat::NV12;
+}
+
+/* size of one tightly packed width x height frame */
+inline size_t image_bytes(PixelFormat format, int width, int height) {
+  const size_t luma = (size_t)width * height;
+  const size_t chroma = (size_t)((width + 1) / 2) * ((height + 1) / 2);
+  switch (format) {
+  case PixelFormat::RGB24:
+  case PixelFormat::BGR24:
+    return 3 * luma;
+  case PixelFormat::I420:
+  case PixelFormat::NV12:
+    return luma + 2 * chroma;
+  case PixelFormat::GRAY8:
+    return luma;
+  }
+  return 0;
+}
+
+/*
+ * Image is RGB24 generalised to any PixelFormat: up to three planes, each
+ * with its own stride, where planes[i] points at the image's top left
+ * sample.  like RGB24 it keeps the coordinates of the frame it was cut
+ * from and never owns its pixels.
+ *
+ * for I420 and NV12, x0 and y0 are always even so that every luma pair
+ * shares the chroma sample it had in the full frame.
+ */
+class Image {
+public:
+  PixelFormat format;
+  unsigned char * planes[3];
+  int strides[3];
+  int x0, y0, x1, y1;
+
+  Image()
+    : format(PixelFormat::RGB24), planes{nullptr, nullptr, nullptr}, strides{0, 0, 0}, x0(0), y0(0), x1(0), y1(0)
+  { }
+  Image(RGB24 const & rgb)
+    : format(PixelFormat::RGB24), planes{rgb.pix, nullptr, nullptr}, strides{rgb.stride, 0, 0},
+      x0(rgb.x0), y0(rgb.y0), x1(rgb.x1), y1(rgb.y1)
+  { }
+
+  /* a view of one tightly packed width x height frame starting at data */
+  static Image wrap(PixelFormat format, unsigned char * data, int width, int height) {
+    Image ret;
+    ret.format = format;
+    ret.x1 = width;
+    ret.y1 = height;
+    ret.planes[0] = data;
+
+    const int chroma_width = (width + 1) / 2;
+    const int chroma_height = (height + 1) / 2;
+    switch (format) {
+    case PixelFormat::RGB24:
+    case PixelFormat::BGR24:
+      ret.strides[0] = 3 * width;
+      break;
+    case PixelFormat::I420:
+      ret.strides[0] = width;
+      ret.planes[1] = data + (size_t)width * height;
+      ret.strides[1] = chroma_width;
+      ret.planes[2] = ret.planes[1] + (size_t)chroma_width * chroma_height;
+      ret.strides[2] = chroma_width;
+      break;
+    case PixelFormat::NV12:
+      ret.strides[0] = width;
+      ret.planes[1] = data + (size_t)width * height;
+      ret.strides[1] = 2 * chroma_width;
+      break;
+    case PixelFormat::GRAY8:
+      ret.strides[0] = width;
+      break;
+    }
+    return ret;
+  }
+
+  inline int dx() const {
+    return x1 - x0;
+  }
+  inline int dy() const {
+    return y1 - y0;
+  }
+  inline Rect bounds() const {
+    return Rect{x0, y0, x1, y1};
+  }
+  inline bool empty() const {
+    return planes[0] == nullptr || x0 >= x1 || y0 >= y1;
+  }
+
+  /* the RGB24 view of an image in that format */
+  RGB24 rgb24() const {
+    if (format != PixelFormat::RGB24) {
+      throw std::logic_error(std::string("not an RGB24 image: ") + to_string(format));
+    }
+    return RGB24(planes[0], strides[0], x0, y0, x1, y1);
+  }
+
+  /*
+   * returns a view of the part of this image inside r, see RGB24::SubImage.
+   * subsampled formats grow r outwards to even coordinates.
+   */
+  Image SubImage(Rect r) const {
+    if (is_subsampled(format)) {
+      r.x0 &= ~1;
+      r.y0 &= ~1;
+      r.x1 += r.x1 & 1;
+      r.y1 += r.y1 & 1;
+    }
+    r = r.intersect(bounds());
+    if (r.empty()) {
+      Image ret;
+      ret.format = format;
+      return ret;
+    }
+
+    const int ox = r.x0 - x0;
+    const int oy = r.y0 - y0;
+
+    Image ret = *this;
+    ret.x0 = r.x0;
+    ret.y0 = r.y0;
+    ret.x1 = r.x1;
+    ret.y1 = r.y1;
+    switch (format) {
+    case PixelFormat::RGB24:
+    case PixelFormat::BGR24:
+      ret.planes[0] += (size_t)oy * strides[0] + 3 * ox;
+      break;
+    case PixelFormat::I420:
+      ret.planes[0] += (size_t)oy * strides[0] + ox;
+      ret.planes[1] += (size_t)(oy / 2) * strides[1] + ox / 2;
+      ret.planes[2] += (size_t)(oy / 2) * strides[2] + ox / 2;
+      break;
+    case PixelFormat::NV12:
+      ret.planes[0] += (size_t)oy * strides[0] + ox;
+      ret.planes[1] += (size_t)(oy / 2) * strides[1] + ox;
+      break;
+    case PixelFormat::GRAY8:
+      ret.planes[0] += (size_t)oy * strides[0] + ox;
+      break;
+    }
+    return ret;
+  }
+};
+
+/*
+ * copies the pixels of img into dst, tightly packed, and returns a view of
+ * the copy.  dst must hold image_bytes(img.format, img.dx(), img.dy()).
+ */
+inline Image copy_image(Image const & img, unsigned char * dst) {
+  const int width = img.dx();
+  const int height = img.dy();
+  Image ret = Image::wrap(img.format, dst, width, height);
+
+  // bytes per row and rows of each plane
+  int row[3] = {0, 0, 0};
+  int rows[3] = {height, 0, 0};
+  switch (img.format) {
+  case PixelFormat::RGB24:
+  case PixelFormat::BGR24:
+    row[0] = 3 * width;
+    break;
+  case PixelFormat::I420:
+    row[0] = width;
+    row[1] = row[2] = (width + 1) / 2;
+    rows[1] = rows[2] = (height + 1) / 2;
+    break;
+  case PixelFormat::NV12:
+    row[0] = width;
+    row[1] = 2 * ((width + 1) / 2);
+    rows[1] = (height + 1) / 2;
+    break;
+  case PixelFormat::GRAY8:
+    row[0] = width;
+    break;
+  }
+
+  for (int p = 0; p < 3; p++) {
+    for (int y = 0; y < rows[p]; y++) {
+      std::memcpy(ret.planes[p] + (size_t)y * ret.strides[p], img.planes[p] + (size_t)y * img.strides[p], row[p]);
+    }
+  }
+  return ret;
+}
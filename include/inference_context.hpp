@@ -0,0 +1,90 @@
+#pragma once
+
+#include <inference_engine.hpp>
+#include <ext_list.hpp>
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "common.hpp"
+
+using namespace InferenceEngine;
+
+struct InferenceContextOptions {
+  /* directory the plugins are loaded from, empty searches the default paths */
+  std::string plugin_path;
+
+  /* threads the CPU plugin runs every network on, 0 keeps the plugin's default of one per core */
+  size_t cpu_threads;
+
+  /* pins the CPU plugin's threads to cores */
+  bool cpu_bind_threads;
+
+  InferenceContextOptions()
+    : cpu_threads(0), cpu_bind_threads(true)
+  { }
+};
+
+/*
+ * InferenceContext owns one plugin per device, with its extensions, log
+ * callback and CPU thread settings applied once.  every FaceDetector and
+ * Facenet given the same context loads its network into the same plugin, so
+ * a process with several cameras runs all of them on one CPU thread pool
+ * instead of one pool per network.
+ *
+ * networks keep the context alive, it may be dropped by its creator at any
+ * time.  plugins are created on first use and are safe to fetch from any
+ * thread.
+ */
+class InferenceContext {
+  InferenceContextOptions options;
+  ConsoleErrorListener error_listener;
+  std::mutex mutex;
+  std::map<std::string, InferencePlugin> plugins;
+public:
+  InferenceContext(InferenceContextOptions const & options = InferenceContextOptions())
+    : options(options)
+  { }
+  InferenceContext(InferenceContext const &) = delete;
+  InferenceContext & operator=(InferenceContext const &) = delete;
+
+  InferencePlugin get_plugin(std::string const & device) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto i = plugins.find(device);
+    if (i != plugins.end()) {
+      return i->second;
+    }
+
+    InferencePlugin plugin = PluginDispatcher({ options.plugin_path.c_str(), "" }).getPluginByDevice(device);
+    if (device == "CPU") {
+      plugin.AddExtension(std::make_shared<Extensions::Cpu::CpuExtensions>());
+
+      std::map<std::string, std::string> config;
+      if (options.cpu_threads > 0) {
+        config[PluginConfigParams::KEY_CPU_THREADS_NUM] = std::to_string(options.cpu_threads);
+      }
+      config[PluginConfigParams::KEY_CPU_BIND_THREAD] = options.cpu_bind_threads ? PluginConfigParams::YES : PluginConfigParams::NO;
+      plugin.SetConfig(config);
+    } else if (device == "MYRIAD") {
+      plugin.SetConfig({{"VPU_LOG_LEVEL", "LOG_WARNING"}});
+    }
+    static_cast<InferenceEngine::InferenceEnginePluginPtr>(plugin)->SetLogCallback(error_listener);
+
+    std::clog << "plugin for " << device << " created\n";
+    plugins[device] = plugin;
+    return plugin;
+  }
+
+  InferenceContextOptions const & get_options() const {
+    return options;
+  }
+};
+
+/* what the C API's inference_context points at */
+struct inference_context_tag {
+  std::shared_ptr<InferenceContext> context;
+};
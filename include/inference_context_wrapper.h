@@ -0,0 +1,41 @@
+#ifndef __INFERENCE_CONTEXT_WRAPPER_H__
+#define __INFERENCE_CONTEXT_WRAPPER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  /*
+   * plugins shared by every detector and classifier created with the same
+   * context.  destroying the context only drops the caller's reference, the
+   * networks created with it keep it alive.
+   */
+  typedef struct inference_context_tag inference_context;
+
+  typedef struct inference_context_options_tag {
+    /* directory the plugins are loaded from, NULL searches the default paths */
+    const char * plugin_path;
+    /* threads the CPU plugin runs all networks on, 0 is one per core */
+    int cpu_threads;
+    /* non-zero pins the CPU plugin's threads to cores */
+    int cpu_bind_threads;
+  } inference_context_options;
+
+  /* CPU plugin settings a network is loaded with, see performance_profile.hpp */
+  typedef enum performance_profile_tag {
+    PROFILE_DEFAULT = 0,
+    PROFILE_LATENCY = 1,
+    PROFILE_THROUGHPUT = 2,
+    PROFILE_BALANCED = 3
+  } performance_profile;
+
+  void inference_context_options_init(inference_context_options * opts);
+
+  inference_context * inference_context_create(const inference_context_options * opts);
+  void inference_context_destroy(inference_context * c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "jpeglib.h"
+
+#include "common.hpp"
+#include "image.hpp"
+#include "pixel_convert.hpp"
+
+/*
+ * JpegEncoder keeps one libjpeg compressor, with its quantization and
+ * Huffman tables, alive across encodes, so that encoding a crop costs the
+ * compression itself and not the setup around it.
+ *
+ * encode() writes straight into the caller's vector: it is grown while
+ * libjpeg writes and trimmed to the encoded size at the end, and never
+ * copied.  a vector reused across calls stops reallocating once it has
+ * held the largest image.
+ *
+ * rows are read from the image through its stride, so a crop is encoded
+ * straight out of its frame.  with a max_edge, larger images are shrunk
+ * by a RowScaler inside the same row loop, and formats other than RGB24
+ * are converted a row at a time, so neither ever makes a full size copy.
+ *
+ * libjpeg errors are thrown as std::runtime_error and leave the encoder
+ * usable.  an encoder must not be used by two threads at once.
+ */
+class JpegEncoder {
+  struct error_manager {
+    jpeg_error_mgr pub;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+  };
+
+  struct destination {
+    jpeg_destination_mgr pub;
+    std::vector<unsigned char> * out;
+  };
+
+  jpeg_compress_struct cinfo;
+  error_manager jerr;
+  destination dest;
+  int quality;
+
+  // row pointers of the image being encoded
+  std::vector<JSAMPROW> rows;
+  // two converted source rows, for formats other than RGB24
+  std::vector<unsigned char> converted;
+  int converted_rows[2];
+
+  static void error_exit(j_common_ptr cinfo) {
+    error_manager * err = reinterpret_cast<error_manager *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    std::longjmp(err->jump, 1);
+  }
+
+  static void init_destination(j_compress_ptr cinfo) {
+    destination * d = reinterpret_cast<destination *>(cinfo->dest);
+    std::vector<unsigned char> & out = *d->out;
+    // the buffer's current size is free room, a fresh one starts at an estimate
+    if (out.size() < 4096) {
+      out.resize(std::max<size_t>(4096, (size_t)cinfo->image_width * cinfo->image_height / 4));
+    }
+    d->pub.next_output_byte = out.data();
+    d->pub.free_in_buffer = out.size();
+  }
+
+  static boolean empty_output_buffer(j_compress_ptr cinfo) {
+    destination * d = reinterpret_cast<destination *>(cinfo->dest);
+    std::vector<unsigned char> & out = *d->out;
+    // libjpeg only calls this once the whole buffer is full
+    size_t used = out.size();
+    out.resize(2 * used);
+    d->pub.next_output_byte = out.data() + used;
+    d->pub.free_in_buffer = out.size() - used;
+    return TRUE;
+  }
+
+  static void term_destination(j_compress_ptr cinfo) {
+    destination * d = reinterpret_cast<destination *>(cinfo->dest);
+    d->out->resize(d->out->size() - d->pub.free_in_buffer);
+  }
+
+  /*
+   * compresses a width x height image whose rows row(y) returns as packed
+   * RGB24, in increasing y.  all returns false after a libjpeg error.
+   */
+  template<typename RowFn>
+  bool compress(int width, int height, RowFn row, std::vector<unsigned char> & out) {
+    dest.out = &out;
+
+    if (setjmp(jerr.jump)) {
+      jpeg_abort_compress(&cinfo);
+      return false;
+    }
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+      JSAMPROW p = const_cast<JSAMPROW>(row((int)cinfo.next_scanline));
+      jpeg_write_scanlines(&cinfo, &p, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    return true;
+  }
+
+  /* compresses an RGB24 view, handing libjpeg every row at once */
+  bool compress(RGB24 const & rgb, std::vector<unsigned char> & out) {
+    rows.resize(rgb.dy());
+    for (int y = 0; y < rgb.dy(); y++) {
+      rows[y] = rgb.pix + (size_t)y * rgb.stride;
+    }
+    dest.out = &out;
+
+    if (setjmp(jerr.jump)) {
+      jpeg_abort_compress(&cinfo);
+      return false;
+    }
+    cinfo.image_width = rgb.dx();
+    cinfo.image_height = rgb.dy();
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+      jpeg_write_scanlines(&cinfo, rows.data() + cinfo.next_scanline, cinfo.image_height - cinfo.next_scanline);
+    }
+    jpeg_finish_compress(&cinfo);
+    return true;
+  }
+
+  /* source row y of img as packed RGB24, converting it when needed */
+  const unsigned char * source_row(Image const & img, int y) {
+    if (img.format == PixelFormat::RGB24) {
+      return img.planes[0] + (size_t)y * img.strides[0];
+    }
+    // consecutive rows land in different slots, so the pair in use is never evicted
+    unsigned char * dst = &converted[(y & 1) * 3 * (size_t)img.dx()];
+    if (converted_rows[y & 1] != y) {
+      pixel_convert::image_row_to_rgb24(img, y, dst);
+      converted_rows[y & 1] = y;
+    }
+    return dst;
+  }
+public:
+  JpegEncoder(int quality = 90)
+    : quality(quality)
+  {
+    converted_rows[0] = converted_rows[1] = -1;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = &error_exit;
+    jerr.message[0] = 0;
+    jpeg_create_compress(&cinfo);
+
+    dest.pub.init_destination = &init_destination;
+    dest.pub.empty_output_buffer = &empty_output_buffer;
+    dest.pub.term_destination = &term_destination;
+    dest.out = nullptr;
+    cinfo.dest = &dest.pub;
+
+    // the tables set here are kept for every image encoded
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE /* limit to baseline-JPEG values */);
+  }
+  ~JpegEncoder() {
+    jpeg_destroy_compress(&cinfo);
+  }
+  JpegEncoder(JpegEncoder const &) = delete;
+  JpegEncoder & operator=(JpegEncoder const &) = delete;
+
+  int get_quality() const {
+    return quality;
+  }
+  /* rebuilds the quantization tables, only when the quality changes */
+  void set_quality(int q) {
+    if (q != quality) {
+      quality = q;
+      jpeg_set_quality(&cinfo, quality, TRUE);
+    }
+  }
+
+  /*
+   * encodes img, which may be a strided view into a larger frame, into out.
+   * when max_edge is set, images with a longer side are shrunk to fit it.
+   */
+  void encode(Image const & img, std::vector<unsigned char> & out, int max_edge = 0) {
+    if (img.empty()) {
+      throw std::logic_error("can't encode an empty image");
+    }
+
+    int width = img.dx();
+    int height = img.dy();
+    const bool scale = max_edge > 0 && std::max(width, height) > max_edge;
+    if (scale) {
+      if (width >= height) {
+        height = std::max(1, (int)((int64_t)height * max_edge / width));
+        width = max_edge;
+      } else {
+        width = std::max(1, (int)((int64_t)width * max_edge / height));
+        height = max_edge;
+      }
+    }
+
+    bool ok;
+    if (!scale && img.format == PixelFormat::RGB24) {
+      ok = compress(img.rgb24(), out);
+    } else {
+      if (img.format != PixelFormat::RGB24) {
+        converted.resize(2 * 3 * (size_t)img.dx());
+        converted_rows[0] = converted_rows[1] = -1;
+      }
+      auto src = [&](int y) { return source_row(img, y); };
+      if (scale) {
+        RowScaler scaler(img.dx(), img.dy(), width, height);
+        ok = compress(width, height, [&](int y) { return scaler.row(y, src); }, out);
+      } else {
+        ok = compress(width, height, src, out);
+      }
+    }
+
+    if (!ok) {
+      out.clear();
+      throw std::runtime_error(std::string("jpeg encoding failed: ") + jerr.message);
+    }
+  }
+
+  /* encodes img into filename */
+  void write(Image const & img, std::string const & filename, std::vector<unsigned char> & scratch, int max_edge = 0) {
+    encode(img, scratch, max_edge);
+
+    FILE * f = std::fopen(filename.c_str(), "wb");
+    if (f == nullptr) {
+      throw std::runtime_error("can't open " + filename);
+    }
+    size_t written = std::fwrite(scratch.data(), 1, scratch.size(), f);
+    if (std::fclose(f) != 0 || written != scratch.size()) {
+      throw std::runtime_error("can't write " + filename);
+    }
+  }
+};
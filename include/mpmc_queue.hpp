@@ -0,0 +1,163 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "backoff.hpp"
+
+/*
+ * MpmcQueue is a bounded lock-free queue for any number of producers and
+ * consumers (Dmitry Vyukov's sequence-numbered ring).  the capacity is
+ * rounded up to a power of two.
+ *
+ * close() is meant to be called once every producer is done: afterwards
+ * push() fails, and pop() returns the remaining items and then fails.  it
+ * has the same interface as BoundedQueue so the two can be swapped.
+ *
+ * push() and pop() spin and yield for a while, then sleep on an EventCount
+ * until the other side or close() wakes them, so an idle stage costs
+ * nothing.
+ */
+template<typename T> class MpmcQueue {
+  struct cell {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  std::vector<cell> cells;
+  size_t mask;
+
+  char pad0[64];
+  std::atomic<size_t> enqueue_pos;
+  char pad1[64];
+  std::atomic<size_t> dequeue_pos;
+  char pad2[64];
+  std::atomic<bool> closed;
+  // consumers waiting for an item and producers waiting for room
+  EventCount not_empty;
+  EventCount not_full;
+
+  static size_t round_up(size_t n) {
+    size_t p = 2;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+public:
+  MpmcQueue(size_t capacity)
+    : cells(round_up(capacity)), mask(cells.size() - 1), enqueue_pos(0), dequeue_pos(0), closed(false)
+  {
+    for (size_t i = 0; i < cells.size(); i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  bool try_push(T & item) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+      cell & c = cells[pos & mask];
+      size_t seq = c.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          c.item = std::move(item);
+          c.sequence.store(pos + 1, std::memory_order_release);
+          not_empty.notify();
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  bool try_pop(T & item) {
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+      cell & c = cells[pos & mask];
+      size_t seq = c.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          item = std::move(c.item);
+          c.sequence.store(pos + mask + 1, std::memory_order_release);
+          not_full.notify();
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  /* waits for room, returns false if the queue was closed */
+  bool push(T item) {
+    Backoff backoff;
+    while (!closed.load(std::memory_order_acquire)) {
+      if (try_push(item)) {
+        return true;
+      }
+      if (backoff.pause()) {
+        continue;
+      }
+      uint64_t key = not_full.prepare_wait();
+      if (closed.load(std::memory_order_acquire)) {
+        not_full.cancel_wait();
+        break;
+      }
+      if (try_push(item)) {
+        not_full.cancel_wait();
+        return true;
+      }
+      not_full.wait(key);
+    }
+    return false;
+  }
+  /* waits for an item, returns false once the queue is closed and drained */
+  bool pop(T & item) {
+    Backoff backoff;
+    while (true) {
+      if (try_pop(item)) {
+        return true;
+      }
+      if (closed.load(std::memory_order_acquire)) {
+        // anything pushed before close() is visible now
+        return try_pop(item);
+      }
+      if (backoff.pause()) {
+        continue;
+      }
+      uint64_t key = not_empty.prepare_wait();
+      if (try_pop(item)) {
+        not_empty.cancel_wait();
+        return true;
+      }
+      if (closed.load(std::memory_order_acquire)) {
+        not_empty.cancel_wait();
+        return try_pop(item);
+      }
+      not_empty.wait(key);
+    }
+  }
+  void close() {
+    closed.store(true, std::memory_order_release);
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+  bool is_closed() const {
+    return closed.load(std::memory_order_acquire);
+  }
+  size_t size() const {
+    size_t e = enqueue_pos.load(std::memory_order_acquire);
+    size_t d = dequeue_pos.load(std::memory_order_acquire);
+    return e > d ? e - d : 0;
+  }
+  size_t get_capacity() const {
+    return cells.size();
+  }
+};
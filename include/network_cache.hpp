@@ -0,0 +1,249 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <inference_engine.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/*
+ * NetworkCache keeps compiled networks on disk so that a restart can skip
+ * reading the IR and compiling it.  entries are keyed by a fingerprint of
+ * the model files' paths, sizes and modification times, the device, the
+ * plugin config and whatever input settings the caller applied before
+ * LoadNetwork, so changing any of them is a miss.
+ *
+ * an exported network keeps neither the input preprocessing (resize, color
+ * format) nor the input layout requested on the CNNNetwork, so callers
+ * that cache compile their networks without preprocessing and resize and
+ * convert frames themselves.
+ *
+ * each entry is the plugin's Export() blob plus a small metadata file with
+ * the names and sizes the caller would otherwise read from the IR.  the
+ * metadata is written last, an entry without it is ignored.
+ *
+ * an empty directory disables the cache, and so does a device whose plugin
+ * cannot Export (CPU and GPU in this IE release), see supports_export().
+ * callers then keep their plugin preprocessing, which caching would cost
+ * them for nothing.
+ */
+class NetworkCache {
+public:
+  typedef std::map<std::string, std::string> metadata;
+
+  struct stats {
+    size_t hits;
+    size_t misses;
+    size_t exports;
+    // Export or ImportNetwork threw, usually because the plugin lacks them
+    size_t failures;
+  };
+private:
+  struct counters_t {
+    std::atomic<size_t> hits;
+    std::atomic<size_t> misses;
+    std::atomic<size_t> exports;
+    std::atomic<size_t> failures;
+
+    counters_t()
+      : hits(0), misses(0), exports(0), failures(0)
+    { }
+  };
+  /* shared by every cache in the process */
+  static counters_t & counters() {
+    static counters_t c;
+    return c;
+  }
+
+  std::string dir;
+
+  /* 64 bit FNV-1a */
+  static uint64_t hash(uint64_t h, const void * data, size_t size) {
+    const unsigned char * p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++) {
+      h ^= p[i];
+      h *= 0x100000001b3ULL;
+    }
+    return h;
+  }
+  static uint64_t hash(uint64_t h, std::string const & s) {
+    // the length keeps "ab","c" apart from "a","bc"
+    uint64_t n = s.size();
+    h = hash(h, &n, sizeof(n));
+    return hash(h, s.data(), s.size());
+  }
+  /* identifies a file by its path, size and mtime, without reading it */
+  static uint64_t hash_file(uint64_t h, std::string const & filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+      throw std::runtime_error("can't stat " + filename);
+    }
+    uint64_t id[3] = {
+      (uint64_t)st.st_size,
+      (uint64_t)st.st_mtime,
+#ifdef __linux__
+      (uint64_t)st.st_mtim.tv_nsec
+#else
+      0
+#endif
+    };
+    h = hash(h, filename);
+    return hash(h, id, sizeof(id));
+  }
+
+  std::string path(std::string const & key, const char * suffix) const {
+    return dir + "/" + key + suffix;
+  }
+
+  static bool read_metadata(std::string const & filename, metadata & meta) {
+    std::ifstream fs(filename);
+    if (!fs) {
+      return false;
+    }
+    std::string line;
+    while (std::getline(fs, line)) {
+      auto sp = line.find(' ');
+      if (sp != std::string::npos) {
+        meta[line.substr(0, sp)] = line.substr(sp + 1);
+      }
+    }
+    return true;
+  }
+  static bool write_metadata(std::string const & filename, metadata const & meta) {
+    std::ofstream fs(filename, std::ios::out | std::ios::trunc);
+    for (auto const & kv : meta) {
+      fs << kv.first << " " << kv.second << "\n";
+    }
+    fs.close();
+    return !fs.fail();
+  }
+public:
+  /* true for the devices whose plugin can Export and Import a compiled network */
+  static bool supports_export(std::string const & device) {
+    for (const char * name : {"MYRIAD", "HDDL", "GNA"}) {
+      if (device.compare(0, std::strlen(name), name) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* a cache in dir for networks loaded on device, disabled when device can't export */
+  NetworkCache(std::string const & dir, std::string const & device)
+    : dir(supports_export(device) ? dir : std::string())
+  {
+    if (!dir.empty() && this->dir.empty()) {
+      std::clog << "network cache: " << device << " can't export compiled networks, not caching\n";
+    }
+  }
+
+  bool enabled() const {
+    return !dir.empty();
+  }
+
+  /*
+   * extra describes anything the caller changes on the network before
+   * loading it (layouts, precisions, batch size) and must differ whenever
+   * the compiled network would.
+   */
+  std::string fingerprint(std::string const & networkFile, std::string const & networkWeights,
+                          std::string const & device, std::map<std::string, std::string> const & config,
+                          std::string const & extra) const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = hash_file(h, networkFile);
+    h = hash_file(h, networkWeights);
+    h = hash(h, device);
+    for (auto const & kv : config) {
+      h = hash(h, kv.first);
+      h = hash(h, kv.second);
+    }
+    h = hash(h, extra);
+    const InferenceEngine::Version * version = InferenceEngine::GetInferenceEngineVersion();
+    if (version != nullptr && version->buildNumber != nullptr) {
+      h = hash(h, std::string(version->buildNumber));
+    }
+
+    std::ostringstream ss;
+    ss << device << "-" << std::hex << std::setfill('0') << std::setw(16) << h;
+    return ss.str();
+  }
+
+  /* loads the entry for key into net and meta, returns false on a miss */
+  bool Import(InferenceEngine::InferencePlugin & plugin, std::string const & key,
+              std::map<std::string, std::string> const & config,
+              InferenceEngine::ExecutableNetwork & net, metadata & meta) {
+    if (!enabled()) {
+      return false;
+    }
+
+    meta.clear();
+    if (!read_metadata(path(key, ".meta"), meta)) {
+      counters().misses++;
+      std::clog << "network cache miss: " << key << "\n";
+      return false;
+    }
+
+    try {
+      net = plugin.ImportNetwork(path(key, ".blob"), config);
+    } catch (std::exception const & e) {
+      counters().failures++;
+      counters().misses++;
+      std::clog << "network cache: can't import " << key << ": " << e.what() << "\n";
+      return false;
+    }
+
+    counters().hits++;
+    std::clog << "network cache hit: " << key << "\n";
+    return true;
+  }
+
+  /* stores net under key, failures are logged and otherwise ignored */
+  void Export(InferenceEngine::ExecutableNetwork & net, std::string const & key, metadata const & meta) {
+    if (!enabled()) {
+      return;
+    }
+
+    const std::string blob = path(key, ".blob");
+    const std::string info = path(key, ".meta");
+    try {
+      // written under temporary names so a crash never leaves a half entry behind
+      net.Export(blob + ".tmp");
+      if (std::rename((blob + ".tmp").c_str(), blob.c_str()) != 0) {
+        throw std::runtime_error("can't rename " + blob + ".tmp");
+      }
+      if (!write_metadata(info + ".tmp", meta) || std::rename((info + ".tmp").c_str(), info.c_str()) != 0) {
+        throw std::runtime_error("can't write " + info);
+      }
+    } catch (std::exception const & e) {
+      counters().failures++;
+      std::remove((blob + ".tmp").c_str());
+      std::remove((info + ".tmp").c_str());
+      std::clog << "network cache: can't export " << key << ": " << e.what() << "\n";
+      return;
+    }
+
+    counters().exports++;
+    std::clog << "network cache stored: " << key << "\n";
+  }
+
+  static stats get_stats() {
+    counters_t & c = counters();
+    return stats{c.hits, c.misses, c.exports, c.failures};
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, NetworkCache::stats const & s) {
+  os << "network cache hits: " << s.hits << " misses: " << s.misses
+     << " exports: " << s.exports << " failures: " << s.failures;
+  return os;
+}
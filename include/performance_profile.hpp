@@ -0,0 +1,78 @@
+#pragma once
+
+#include <inference_engine.hpp>
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+/*
+ * named sets of CPU plugin settings passed to LoadNetwork.
+ *
+ *   latency     one stream using every core, each request finishes as fast
+ *               as possible.
+ *   throughput  as many streams as the plugin sees fit, each on a few
+ *               cores.  single requests get slower but many requests in
+ *               flight finish more frames per second.
+ *   balanced    one stream per NUMA node, threads kept on their node.
+ *
+ * streams only pay off with at least as many requests in flight, see
+ * DetectorOptions::num_requests.  devices other than CPU ignore the profile.
+ * the values match the C API's performance_profile.
+ */
+enum class PerformanceProfile {
+  Default = 0,
+  Latency = 1,
+  Throughput = 2,
+  Balanced = 3
+};
+
+inline const char * to_string(PerformanceProfile profile) {
+  switch (profile) {
+  case PerformanceProfile::Latency: return "latency";
+  case PerformanceProfile::Throughput: return "throughput";
+  case PerformanceProfile::Balanced: return "balanced";
+  default: return "default";
+  }
+}
+
+inline PerformanceProfile parse_performance_profile(std::string const & name) {
+  if (name == "latency") return PerformanceProfile::Latency;
+  if (name == "throughput") return PerformanceProfile::Throughput;
+  if (name == "balanced") return PerformanceProfile::Balanced;
+  if (name == "default" || name.empty()) return PerformanceProfile::Default;
+  throw std::invalid_argument("unknown performance profile '" + name + "'");
+}
+
+/*
+ * adds the LoadNetwork settings of profile on device to config.  a non-zero
+ * streams overrides the profile's stream count, e.g. with a tuned value.
+ */
+inline void apply_performance_profile(PerformanceProfile profile, size_t streams, std::string const & device,
+                                      std::map<std::string, std::string> & config) {
+  using namespace InferenceEngine;
+
+  if (device != "CPU") {
+    return;
+  }
+  switch (profile) {
+  case PerformanceProfile::Latency:
+    config[PluginConfigParams::KEY_CPU_THROUGHPUT_STREAMS] = "1";
+    config[PluginConfigParams::KEY_CPU_BIND_THREAD] = PluginConfigParams::YES;
+    break;
+  case PerformanceProfile::Throughput:
+    config[PluginConfigParams::KEY_CPU_THROUGHPUT_STREAMS] = PluginConfigParams::CPU_THROUGHPUT_AUTO;
+    config[PluginConfigParams::KEY_CPU_BIND_THREAD] = PluginConfigParams::YES;
+    break;
+  case PerformanceProfile::Balanced:
+    config[PluginConfigParams::KEY_CPU_THROUGHPUT_STREAMS] = PluginConfigParams::CPU_THROUGHPUT_NUMA;
+    config[PluginConfigParams::KEY_CPU_BIND_THREAD] = PluginConfigParams::NUMA;
+    break;
+  default:
+    break;
+  }
+
+  if (streams > 0) {
+    config[PluginConfigParams::KEY_CPU_THROUGHPUT_STREAMS] = std::to_string(streams);
+  }
+}
@@ -0,0 +1,554 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "common.hpp"
+#include "image.hpp"
+#include "mpmc_queue.hpp"
+#include "spsc_ring.hpp"
+#include "buffer_pool.hpp"
+#include "embedding_batcher.hpp"
+#include "face_detector.hpp"
+#include "facenet.hpp"
+
+/* one frame travelling through the pipeline */
+struct PipelineFrame {
+  uint64_t id;
+  // producer the frame came from, 0 for a single local source
+  uint32_t stream;
+  // capture time in microseconds since the epoch, the producer's own if it
+  // sent one, otherwise the time the frame was read
+  uint64_t timestamp;
+  // keep the pixels that image points into alive: a pooled buffer, or a pin
+  // on a shared memory slot.  both are empty when the pixels outlive the
+  // pipeline anyway, as with a FrameFile.  a pinned frame is only held until
+  // it has been detected: its face crops are then copied into data and the
+  // pin is dropped, see Pipeline
+  BufferHandle data;
+  std::shared_ptr<void> pin;
+  Image image;
+
+  PipelineFrame()
+    : id(0), stream(0), timestamp(0)
+  { }
+};
+
+/* one detected face, filled in stage by stage */
+struct PipelineFace {
+  std::shared_ptr<PipelineFrame> frame;
+  Proposal proposal;
+  // pixel rectangle of the face inside frame->image
+  int x0, y0, x1, y1;
+  // view of the face inside frame->image, or of its copy in frame->data
+  // once a pinned frame has been released; frame keeps the pixels alive.
+  // subsampled formats widen it to even coordinates
+  Image crop;
+  std::vector<float> embedding;
+
+  PipelineFace()
+    : x0(0), y0(0), x1(0), y1(0)
+  { }
+};
+
+struct PipelineOptions {
+  size_t detector_threads;
+  size_t embed_threads;
+  size_t writer_threads;
+  // capacity of each queue between two stages
+  size_t queue_depth;
+  // keep only the newest frame read and drop the ones the detectors had no
+  // time for, rather than processing every frame in order
+  bool live;
+  // when set, embed threads wait up to this long for a full batch rather
+  // than embedding whatever faces happen to be queued
+  size_t embed_delay_ms;
+
+  PipelineOptions()
+    : detector_threads(1), embed_threads(1), writer_threads(1), queue_depth(8), live(false), embed_delay_ms(0)
+  { }
+};
+
+/*
+ * Pipeline runs face detection as four stages connected by bounded queues:
+ *
+ *   reader -> detector -> crop/embed -> writer
+ *
+ * the queues are lock-free MpmcQueues, except that frames go from the
+ * reader to a lone detector thread through an SpscRing.  the reader is a
+ * single thread calling the source until it returns false.  every detector thread owns a
+ * FaceDetector and keeps as many frames in flight as the detector has
+ * requests.  embed threads own a Facenet each and batch whatever faces are
+ * queued, up to the network's batch size.  writer threads hand finished
+ * faces to the sink, which must be thread safe when there is more than one
+ * writer.
+ *
+ * with full queues the slowest stage sets the pace and every other stage
+ * blocks on it, so throughput is bounded by that stage alone.
+ *
+ * a frame that comes with a pin, like a shared memory slot, is held only
+ * until its detections are collected.  its face crops are then copied into
+ * a pooled buffer and the pin is dropped, so the slot is not kept busy while
+ * the faces wait for the embed and write stages.
+ *
+ * a live pipeline has no frame queue: the reader keeps overwriting a single
+ * latest frame, and a detector ready for a frame takes whatever is newest.
+ * frames overwritten before a detector took them are counted as dropped,
+ * and the time from capture to detections stays bounded however far the
+ * source outpaces the detectors.
+ */
+class Pipeline {
+public:
+  typedef std::shared_ptr<PipelineFrame> frame_ptr;
+  typedef std::shared_ptr<PipelineFace> face_ptr;
+
+  /* fills in the next frame's pixels, returns false at the end of the stream */
+  typedef std::function<bool(PipelineFrame &)> source_fn;
+  typedef std::function<std::unique_ptr<FaceDetector>()> detector_factory;
+  typedef std::function<std::unique_ptr<Facenet>()> facenet_factory;
+  typedef std::function<void(PipelineFace &)> sink_fn;
+
+  struct stats {
+    size_t frames;
+    size_t faces;
+    size_t written;
+    // time spent working (not waiting on queues) summed over each stage's threads
+    double reader_ms;
+    double detector_ms;
+    double embed_ms;
+    double writer_ms;
+    // frames overwritten in live mode before a detector took them
+    size_t dropped;
+    // milliseconds from capture to detections, over every detected frame
+    double latency_p50;
+    double latency_p99;
+    double latency_max;
+    // milliseconds from capture to the sink returning, over every written face
+    double written_p50;
+    double written_p99;
+    double written_max;
+  };
+private:
+  typedef std::chrono::steady_clock Clock;
+  typedef std::chrono::duration<double, std::ratio<1, 1000>> ms;
+
+  /* counts latencies in 1ms buckets, so that long runs take constant memory */
+  class latency_histogram {
+    std::vector<size_t> buckets;
+    size_t count;
+    double max;
+  public:
+    latency_histogram()
+      : buckets(10000), count(0), max(0)
+    { }
+    void add(double ms) {
+      size_t i = ms > 0 ? std::min((size_t)ms, buckets.size() - 1) : 0;
+      buckets[i]++;
+      count++;
+      max = std::max(max, ms);
+    }
+    /* upper edge of the bucket holding the p-th percentile, 0 when empty */
+    double percentile(double p) const {
+      // the smallest sample with at least p percent of samples at or below it
+      size_t rank = std::max<size_t>((size_t)std::ceil(p / 100 * count), 1) - 1;
+      size_t seen = 0;
+      for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+          return std::min<double>(i + 1, max);
+        }
+      }
+      return max;
+    }
+    double get_max() const {
+      return max;
+    }
+  };
+
+  static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  PipelineOptions options;
+  source_fn source;
+  detector_factory make_detector;
+  facenet_factory make_facenet;
+  sink_fn sink;
+
+  // frames reach a single detector thread through frame_ring, several through frames
+  bool single_detector;
+  SpscRing<frame_ptr> frame_ring;
+  MpmcQueue<frame_ptr> frames;
+  MpmcQueue<face_ptr> faces;
+  MpmcQueue<face_ptr> embedded;
+
+  // face crops copied out of pinned frames
+  BufferPool crop_pool;
+
+  std::atomic<size_t> detectors_running;
+  std::atomic<size_t> embedders_running;
+
+  // live mode's single frame slot, in place of frames
+  std::mutex latest_mutex;
+  std::condition_variable latest_ready;
+  frame_ptr latest;
+  bool latest_closed;
+
+  std::mutex mutex;
+  std::exception_ptr error;
+  stats counters;
+  latency_histogram latency;
+  latency_histogram written_latency;
+
+  void fail(std::exception_ptr e) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!error) {
+        error = e;
+      }
+    }
+    close_frames();
+    faces.close();
+    embedded.close();
+  }
+
+  void close_frames() {
+    frame_ring.close();
+    frames.close();
+    {
+      std::lock_guard<std::mutex> lock(latest_mutex);
+      latest_closed = true;
+    }
+    latest_ready.notify_all();
+  }
+
+  /* hands a frame to the detectors, false once they have stopped taking frames */
+  bool put_frame(frame_ptr const & frame) {
+    if (!options.live) {
+      return single_detector ? frame_ring.push(frame) : frames.push(frame);
+    }
+    bool overwritten = false;
+    {
+      std::lock_guard<std::mutex> lock(latest_mutex);
+      if (latest_closed) {
+        return false;
+      }
+      overwritten = latest != nullptr;
+      latest = frame;
+    }
+    latest_ready.notify_one();
+    if (overwritten) {
+      std::lock_guard<std::mutex> lock(mutex);
+      counters.dropped++;
+    }
+    return true;
+  }
+
+  /* takes the next frame, or in live mode the newest one; waits for it when block is set */
+  bool take_frame(frame_ptr & frame, bool block) {
+    if (!options.live && single_detector) {
+      return block ? frame_ring.pop(frame) : frame_ring.try_pop(frame);
+    }
+    if (!options.live) {
+      return block ? frames.pop(frame) : frames.try_pop(frame);
+    }
+    std::unique_lock<std::mutex> lock(latest_mutex);
+    if (block) {
+      latest_ready.wait(lock, [this] { return latest != nullptr || latest_closed; });
+    }
+    if (latest == nullptr) {
+      return false;
+    }
+    frame = std::move(latest);
+    latest = nullptr;
+    return true;
+  }
+
+  void account(double stats::* field, Clock::time_point since, size_t stats::* count = nullptr, size_t n = 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.*field += std::chrono::duration_cast<ms>(Clock::now() - since).count();
+    if (count != nullptr) {
+      counters.*count += n;
+    }
+  }
+
+  void read_stage() {
+    for (uint64_t id = 0; ; id++) {
+      Clock::time_point t0 = Clock::now();
+
+      frame_ptr frame = std::make_shared<PipelineFrame>();
+      frame->id = id;
+      if (!source(*frame)) {
+        break;
+      }
+      if (frame->timestamp == 0) {
+        frame->timestamp = now_us();
+      }
+      account(&stats::reader_ms, t0, &stats::frames, 1);
+
+      if (!put_frame(frame)) {
+        break;
+      }
+    }
+    close_frames();
+  }
+
+  /* copies the face crops out of a pinned frame into a buffer of its own and drops the pin */
+  void release_pin(PipelineFrame & frame, std::vector<face_ptr> const & found) {
+    const PixelFormat format = frame.image.format;
+    size_t total = 0;
+    for (auto const & face : found) {
+      total += image_bytes(format, face->crop.dx(), face->crop.dy());
+    }
+
+    if (total > 0) {
+      frame.data = crop_pool.acquire(total);
+      unsigned char * p = frame.data.data();
+      for (auto const & face : found) {
+        face->crop = copy_image(face->crop, p);
+        p += image_bytes(format, face->crop.dx(), face->crop.dy());
+      }
+    }
+    frame.image = Image();
+    frame.pin.reset();
+  }
+
+  /* turns the detections of one frame into face jobs */
+  bool emit_faces(frame_ptr const & frame, FaceDetector::response const & res) {
+    const Image & image = frame->image;
+    const int width = image.dx();
+    const int height = image.dy();
+
+    std::vector<face_ptr> found;
+    for (auto const & p : res.proposal) {
+      face_ptr face = std::make_shared<PipelineFace>();
+      face->frame = frame;
+      face->proposal = p;
+      face->x0 = image.x0 + (int)(p.xmin * width);
+      face->x1 = image.x0 + (int)(p.xmax * width);
+      face->y0 = image.y0 + (int)(p.ymin * height);
+      face->y1 = image.y0 + (int)(p.ymax * height);
+
+      if (face->x0 < image.x0 || face->x1 >= image.x1 || face->y0 < image.y0 || face->y1 >= image.y1 ||
+          face->x0 >= face->x1 || face->y0 >= face->y1) {
+        continue;
+      }
+
+      face->crop = image.SubImage(Rect{face->x0, face->y0, face->x1, face->y1});
+      found.push_back(face);
+    }
+
+    if (frame->pin) {
+      release_pin(*frame, found);
+    }
+
+    for (auto const & face : found) {
+      if (!faces.push(face)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void detect_stage(FaceDetector & detector) {
+    std::deque<frame_ptr> pending;
+    frame_ptr frame;
+
+    while (true) {
+      if (detector.can_submit()) {
+        // only block for input when there is nothing left to collect
+        if (take_frame(frame, pending.empty())) {
+          Clock::time_point t0 = Clock::now();
+          detector.SubmitImage(frame->image);
+          pending.push_back(frame);
+          account(&stats::detector_ms, t0);
+          continue;
+        }
+        if (pending.empty()) {
+          break;
+        }
+      }
+
+      Clock::time_point t0 = Clock::now();
+      FaceDetector::response res = detector.Collect();
+      frame = pending.front();
+      pending.pop_front();
+      account(&stats::detector_ms, t0, &stats::faces, res.proposal.size());
+      {
+        uint64_t now = now_us();
+        std::lock_guard<std::mutex> lock(mutex);
+        latency.add(now > frame->timestamp ? (now - frame->timestamp) / 1000. : 0);
+      }
+
+      if (!emit_faces(frame, res)) {
+        break;
+      }
+    }
+  }
+
+  void embed_stage(Facenet & facenet) {
+    if (options.embed_delay_ms > 0) {
+      embed_stage_batched(facenet);
+      return;
+    }
+    const size_t batch = facenet.get_max_batch();
+    face_ptr face;
+
+    while (faces.pop(face)) {
+      std::vector<face_ptr> jobs(1, face);
+      while (jobs.size() < batch && faces.try_pop(face)) {
+        jobs.push_back(face);
+      }
+
+      Clock::time_point t0 = Clock::now();
+      std::vector<Image> crops;
+      for (auto const & f : jobs) {
+        crops.push_back(f->crop);
+      }
+      std::vector<Facenet::response> res = facenet.InferBatch(crops);
+      for (size_t i = 0; i < jobs.size(); i++) {
+        jobs[i]->embedding.swap(res[i].embedding);
+      }
+      account(&stats::embed_ms, t0);
+
+      for (auto const & f : jobs) {
+        if (!embedded.push(f)) {
+          return;
+        }
+      }
+    }
+  }
+
+  /* embeds through an EmbeddingBatcher, which fills batches up to a deadline */
+  void embed_stage_batched(Facenet & facenet) {
+    EmbeddingBatcher batcher(facenet, 0, std::chrono::milliseconds(options.embed_delay_ms));
+    face_ptr face;
+
+    while (faces.pop(face)) {
+      batcher.Submit(face->crop, [this, face](Facenet::response & res, std::exception_ptr err) {
+        if (err) {
+          fail(err);
+          return;
+        }
+        face->embedding.swap(res.embedding);
+        embedded.push(face);
+      });
+    }
+    // every face must have reached embedded before this stage counts as done
+    batcher.Flush();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.embed_ms += batcher.get_stats().busy_ms;
+  }
+
+  void write_stage() {
+    face_ptr face;
+    while (embedded.pop(face)) {
+      Clock::time_point t0 = Clock::now();
+      sink(*face);
+      account(&stats::writer_ms, t0, &stats::written, 1);
+      {
+        uint64_t now = now_us();
+        std::lock_guard<std::mutex> lock(mutex);
+        written_latency.add(now > face->frame->timestamp ? (now - face->frame->timestamp) / 1000. : 0);
+      }
+    }
+  }
+
+  /* runs a stage, and closes the downstream queue once the last thread of the stage is done */
+  std::thread spawn(std::function<void()> stage, std::atomic<size_t> * running, MpmcQueue<face_ptr> * downstream) {
+    return std::thread([this, stage, running, downstream] {
+      try {
+        stage();
+      } catch (...) {
+        fail(std::current_exception());
+      }
+      if (running != nullptr && --*running == 0) {
+        downstream->close();
+      }
+    });
+  }
+public:
+  Pipeline(PipelineOptions const & options, source_fn source,
+           detector_factory make_detector, facenet_factory make_facenet, sink_fn sink)
+    : options(options), source(source), make_detector(make_detector), make_facenet(make_facenet), sink(sink),
+      single_detector(options.detector_threads <= 1),
+      frame_ring(single_detector ? options.queue_depth : 1), frames(single_detector ? 1 : options.queue_depth),
+      faces(options.queue_depth), embedded(options.queue_depth),
+      detectors_running(0), embedders_running(0), latest_closed(false)
+  {
+    counters = stats{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  }
+
+  /* blocks until the source is exhausted and every stage has drained, rethrows the first stage error */
+  void run() {
+    // networks are loaded up front, one at a time
+    std::vector<std::unique_ptr<FaceDetector>> detectors;
+    for (size_t i = 0; i < std::max<size_t>(options.detector_threads, 1); i++) {
+      detectors.push_back(make_detector());
+    }
+    std::vector<std::unique_ptr<Facenet>> facenets;
+    for (size_t i = 0; i < std::max<size_t>(options.embed_threads, 1); i++) {
+      facenets.push_back(make_facenet());
+    }
+
+    detectors_running = detectors.size();
+    embedders_running = facenets.size();
+
+    std::vector<std::thread> threads;
+    threads.push_back(spawn([this] { read_stage(); }, nullptr, nullptr));
+    for (auto & d : detectors) {
+      FaceDetector * detector = d.get();
+      threads.push_back(spawn([this, detector] { detect_stage(*detector); }, &detectors_running, &faces));
+    }
+    for (auto & f : facenets) {
+      Facenet * facenet = f.get();
+      threads.push_back(spawn([this, facenet] { embed_stage(*facenet); }, &embedders_running, &embedded));
+    }
+    for (size_t i = 0; i < std::max<size_t>(options.writer_threads, 1); i++) {
+      threads.push_back(spawn([this] { write_stage(); }, nullptr, nullptr));
+    }
+
+    for (auto & t : threads) {
+      t.join();
+    }
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  stats get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    stats ret = counters;
+    ret.latency_p50 = latency.percentile(50);
+    ret.latency_p99 = latency.percentile(99);
+    ret.latency_max = latency.get_max();
+    ret.written_p50 = written_latency.percentile(50);
+    ret.written_p99 = written_latency.percentile(99);
+    ret.written_max = written_latency.get_max();
+    return ret;
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, Pipeline::stats const & s) {
+  os << "frames: " << s.frames << " faces: " << s.faces << " written: " << s.written
+     << "\n\tbusy ms reader/detector/embed/writer: "
+     << s.reader_ms << "/" << s.detector_ms << "/" << s.embed_ms << "/" << s.writer_ms
+     << "\n\tdropped: " << s.dropped
+     << " capture to detections ms p50/p99/max: " << s.latency_p50 << "/" << s.latency_p99 << "/" << s.latency_max
+     << "\n\tcapture to written ms p50/p99/max: " << s.written_p50 << "/" << s.written_p99 << "/" << s.written_max;
+  return os;
+}
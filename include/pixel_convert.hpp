@@ -0,0 +1,561 @@
+#pragma once
+
+#include "common.hpp"
+#include "image.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#include <immintrin.h>
+#define PIXEL_CONVERT_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIXEL_CONVERT_NEON 1
+#endif
+
+/*
+ * Conversion of packed RGB24 pixels into the planar BGR (NCHW) layout that
+ * the inference engine expects on its U8 inputs.
+ *
+ * Each row of the source view is deinterleaved in a single pass.  On x86 the
+ * widest kernel supported by the running cpu is picked once at startup
+ * (AVX2, then SSSE3), on ARM the NEON structure loads are used, and anything
+ * else falls back to a plain scalar loop.
+ *
+ * The image_* functions accept any PixelFormat.  BGR24 reuses the RGB
+ * kernels with the planes swapped; YUV and gray rows are converted by
+ * scalar loops straight into the destination.
+ */
+namespace pixel_convert {
+
+typedef void (*rgb_row_kernel)(const unsigned char * src,
+  unsigned char * b, unsigned char * g, unsigned char * r, int n);
+
+inline void rgb_row_to_bgr_planes_scalar(const unsigned char * src,
+  unsigned char * b, unsigned char * g, unsigned char * r, int n)
+{
+  for (int i = 0; i < n; i++, src += 3) {
+    r[i] = src[0];
+    g[i] = src[1];
+    b[i] = src[2];
+  }
+}
+
+#if defined(PIXEL_CONVERT_X86)
+
+/* pshufb masks gathering one channel of 16 pixels out of three 16 byte chunks */
+struct rgb_shuffle_masks {
+  __m128i b[3], g[3], r[3];
+
+  rgb_shuffle_masks() {
+    b[0] = _mm_setr_epi8( 2,  5,  8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    b[1] = _mm_setr_epi8(-1, -1, -1, -1, -1,  1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1);
+    b[2] = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15);
+    g[0] = _mm_setr_epi8( 1,  4,  7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    g[1] = _mm_setr_epi8(-1, -1, -1, -1, -1,  0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1);
+    g[2] = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14);
+    r[0] = _mm_setr_epi8( 0,  3,  6,  9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    r[1] = _mm_setr_epi8(-1, -1, -1, -1, -1, -1,  2,  5,  8, 11, 14, -1, -1, -1, -1, -1);
+    r[2] = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  1,  4,  7, 10, 13);
+  }
+
+  static const rgb_shuffle_masks & get() {
+    static const rgb_shuffle_masks masks;
+    return masks;
+  }
+};
+
+__attribute__((target("ssse3")))
+inline void rgb_row_to_bgr_planes_ssse3(const unsigned char * src,
+  unsigned char * b, unsigned char * g, unsigned char * r, int n)
+{
+  const rgb_shuffle_masks & m = rgb_shuffle_masks::get();
+
+  int i = 0;
+  for (; i + 16 <= n; i += 16, src += 48) {
+    __m128i c0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    __m128i c1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+    __m128i c2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+
+    __m128i vb = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0, m.b[0]), _mm_shuffle_epi8(c1, m.b[1])), _mm_shuffle_epi8(c2, m.b[2]));
+    __m128i vg = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0, m.g[0]), _mm_shuffle_epi8(c1, m.g[1])), _mm_shuffle_epi8(c2, m.g[2]));
+    __m128i vr = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(c0, m.r[0]), _mm_shuffle_epi8(c1, m.r[1])), _mm_shuffle_epi8(c2, m.r[2]));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(b + i), vb);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(g + i), vg);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(r + i), vr);
+  }
+  rgb_row_to_bgr_planes_scalar(src, b + i, g + i, r + i, n - i);
+}
+
+/* same shuffles as the ssse3 kernel, with 16 pixels in each 128 bit lane */
+__attribute__((target("avx2")))
+inline void rgb_row_to_bgr_planes_avx2(const unsigned char * src,
+  unsigned char * b, unsigned char * g, unsigned char * r, int n)
+{
+  const rgb_shuffle_masks & m = rgb_shuffle_masks::get();
+
+  __m256i mb0 = _mm256_broadcastsi128_si256(m.b[0]), mb1 = _mm256_broadcastsi128_si256(m.b[1]), mb2 = _mm256_broadcastsi128_si256(m.b[2]);
+  __m256i mg0 = _mm256_broadcastsi128_si256(m.g[0]), mg1 = _mm256_broadcastsi128_si256(m.g[1]), mg2 = _mm256_broadcastsi128_si256(m.g[2]);
+  __m256i mr0 = _mm256_broadcastsi128_si256(m.r[0]), mr1 = _mm256_broadcastsi128_si256(m.r[1]), mr2 = _mm256_broadcastsi128_si256(m.r[2]);
+
+  int i = 0;
+  for (; i + 32 <= n; i += 32, src += 96) {
+    __m256i c0 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src))),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48)), 1);
+    __m256i c1 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16))),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 64)), 1);
+    __m256i c2 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32))),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 80)), 1);
+
+    __m256i vb = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(c0, mb0), _mm256_shuffle_epi8(c1, mb1)), _mm256_shuffle_epi8(c2, mb2));
+    __m256i vg = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(c0, mg0), _mm256_shuffle_epi8(c1, mg1)), _mm256_shuffle_epi8(c2, mg2));
+    __m256i vr = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(c0, mr0), _mm256_shuffle_epi8(c1, mr1)), _mm256_shuffle_epi8(c2, mr2));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(b + i), vb);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(g + i), vg);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i), vr);
+  }
+  rgb_row_to_bgr_planes_ssse3(src, b + i, g + i, r + i, n - i);
+}
+
+#elif defined(PIXEL_CONVERT_NEON)
+
+inline void rgb_row_to_bgr_planes_neon(const unsigned char * src,
+  unsigned char * b, unsigned char * g, unsigned char * r, int n)
+{
+  int i = 0;
+  for (; i + 16 <= n; i += 16, src += 48) {
+    uint8x16x3_t px = vld3q_u8(src);
+    vst1q_u8(r + i, px.val[0]);
+    vst1q_u8(g + i, px.val[1]);
+    vst1q_u8(b + i, px.val[2]);
+  }
+  rgb_row_to_bgr_planes_scalar(src, b + i, g + i, r + i, n - i);
+}
+
+#endif
+
+inline rgb_row_kernel select_rgb_row_kernel() {
+#if defined(PIXEL_CONVERT_X86)
+  if (__builtin_cpu_supports("avx2")) {
+    return &rgb_row_to_bgr_planes_avx2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return &rgb_row_to_bgr_planes_ssse3;
+  }
+#elif defined(PIXEL_CONVERT_NEON)
+  return &rgb_row_to_bgr_planes_neon;
+#endif
+  return &rgb_row_to_bgr_planes_scalar;
+}
+
+inline rgb_row_kernel rgb_row_to_bgr_planes() {
+  static const rgb_row_kernel kernel = select_rgb_row_kernel();
+  return kernel;
+}
+
+}
+
+/*
+ * writes the pixels of rgb into dst as three consecutive dx()*dy() planes
+ * ordered b, g, r.  rows are read through the view's stride, so rgb may be a
+ * window into a larger frame.
+ */
+inline void rgb24_to_planar_bgr(const RGB24 & rgb, unsigned char * dst) {
+  const pixel_convert::rgb_row_kernel row = pixel_convert::rgb_row_to_bgr_planes();
+
+  const int width = rgb.dx();
+  const int height = rgb.dy();
+  const size_t plane = (size_t)width * height;
+
+  for (int y = 0; y < height; y++) {
+    unsigned char * b = dst + (size_t)y * width;
+
+    row(rgb.pix + (size_t)y * rgb.stride, b, b + plane, b + 2 * plane, width);
+  }
+}
+
+namespace pixel_convert {
+
+/*
+ * bilinearly resamples a width x height image to out_width x out_height and
+ * writes it into dst as b, g, r planes.  row(y) returns source row y as
+ * packed RGB24; it is called with non-decreasing y, at most two rows apart.
+ */
+template<typename RowFn>
+void resize_rows_to_planar_bgr(int width, int height, RowFn row, unsigned char * dst, int out_width, int out_height) {
+  // 11 bit fixed point weights keep the products of two weights inside 32 bits
+  const int shift = 11;
+  const int one = 1 << shift;
+
+  std::vector<int> xoff(out_width), xweight(out_width);
+  const float sx = (float)width / out_width;
+  for (int x = 0; x < out_width; x++) {
+    float fx = std::max(0.f, (x + 0.5f) * sx - 0.5f);
+    int ix = std::min((int)fx, width - 1);
+    xoff[x] = ix;
+    xweight[x] = ix + 1 < width ? (int)((fx - ix) * one) : 0;
+  }
+
+  const size_t plane = (size_t)out_width * out_height;
+  unsigned char * b = dst;
+  unsigned char * g = dst + plane;
+  unsigned char * r = dst + 2 * plane;
+
+  const float sy = (float)height / out_height;
+  for (int y = 0; y < out_height; y++) {
+    float fy = std::max(0.f, (y + 0.5f) * sy - 0.5f);
+    int iy = std::min((int)fy, height - 1);
+    int wy = iy + 1 < height ? (int)((fy - iy) * one) : 0;
+
+    const unsigned char * row0 = row(iy);
+    const unsigned char * row1 = wy ? row(iy + 1) : row0;
+
+    for (int x = 0; x < out_width; x++, b++, g++, r++) {
+      const unsigned char * p0 = row0 + 3 * xoff[x];
+      const unsigned char * p1 = row1 + 3 * xoff[x];
+      const int wx = xweight[x];
+      const int dx = wx ? 3 : 0;
+
+      int v[3];
+      for (int c = 0; c < 3; c++) {
+        int top = p0[c] * (one - wx) + p0[c + dx] * wx;
+        int bottom = p1[c] * (one - wx) + p1[c + dx] * wx;
+        v[c] = (top * (one - wy) + bottom * wy + (1 << (2 * shift - 1))) >> (2 * shift);
+      }
+      *r = (unsigned char)v[0];
+      *g = (unsigned char)v[1];
+      *b = (unsigned char)v[2];
+    }
+  }
+}
+
+}
+
+/*
+ * bilinearly resamples rgb to out_width x out_height and writes it into dst
+ * as b, g, r planes.  used where the plugin cannot resize for us, e.g. when
+ * several differently sized crops share one batched input tensor.
+ */
+inline void rgb24_resize_to_planar_bgr(const RGB24 & rgb, unsigned char * dst, int out_width, int out_height) {
+  const int width = rgb.dx();
+  const int height = rgb.dy();
+
+  if (width == out_width && height == out_height) {
+    rgb24_to_planar_bgr(rgb, dst);
+    return;
+  }
+
+  pixel_convert::resize_rows_to_planar_bgr(width, height, [&rgb](int y) {
+    return (const unsigned char *)rgb.pix + (size_t)y * rgb.stride;
+  }, dst, out_width, out_height);
+}
+
+namespace pixel_convert {
+
+inline unsigned char clamp_u8(int v) {
+  return (unsigned char)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+/* BT.601 limited range, what cameras and gstreamer produce for I420/NV12 */
+inline void yuv_to_rgb(int y, int u, int v, unsigned char & r, unsigned char & g, unsigned char & b) {
+  const int c = 298 * (y - 16) + 128;
+  const int d = u - 128;
+  const int e = v - 128;
+  r = clamp_u8((c + 409 * e) >> 8);
+  g = clamp_u8((c - 100 * d - 208 * e) >> 8);
+  b = clamp_u8((c + 516 * d) >> 8);
+}
+
+/*
+ * converts one row of n luma samples and their chroma.  uv_step is the
+ * distance between consecutive chroma samples: 1 for I420's separate U and
+ * V planes, 2 for NV12's interleaved pairs.
+ */
+inline void yuv_row_to_bgr_planes(const unsigned char * y, const unsigned char * u, const unsigned char * v, int uv_step,
+                                  unsigned char * b, unsigned char * g, unsigned char * r, int n) {
+  for (int i = 0; i < n; i++) {
+    const int c = (i >> 1) * uv_step;
+    yuv_to_rgb(y[i], u[c], v[c], r[i], g[i], b[i]);
+  }
+}
+inline void yuv_row_to_rgb24(const unsigned char * y, const unsigned char * u, const unsigned char * v, int uv_step,
+                             unsigned char * dst, int n) {
+  for (int i = 0; i < n; i++, dst += 3) {
+    const int c = (i >> 1) * uv_step;
+    yuv_to_rgb(y[i], u[c], v[c], dst[0], dst[1], dst[2]);
+  }
+}
+
+/* the chroma rows that luma row y of img uses */
+inline void chroma_rows(const Image & img, int y, const unsigned char * & u, const unsigned char * & v, int & uv_step) {
+  if (img.format == PixelFormat::I420) {
+    u = img.planes[1] + (size_t)(y >> 1) * img.strides[1];
+    v = img.planes[2] + (size_t)(y >> 1) * img.strides[2];
+    uv_step = 1;
+  } else {
+    u = img.planes[1] + (size_t)(y >> 1) * img.strides[1];
+    v = u + 1;
+    uv_step = 2;
+  }
+}
+
+/* writes row y of img, counted from its top, into three planes */
+inline void image_row_to_bgr_planes(const Image & img, int y, unsigned char * b, unsigned char * g, unsigned char * r) {
+  const int n = img.dx();
+  const unsigned char * src = img.planes[0] + (size_t)y * img.strides[0];
+
+  switch (img.format) {
+  case PixelFormat::RGB24:
+    rgb_row_to_bgr_planes()(src, b, g, r, n);
+    break;
+  case PixelFormat::BGR24:
+    // the same shuffle with the destination planes swapped
+    rgb_row_to_bgr_planes()(src, r, g, b, n);
+    break;
+  case PixelFormat::I420:
+  case PixelFormat::NV12: {
+    const unsigned char * u;
+    const unsigned char * v;
+    int uv_step;
+    chroma_rows(img, y, u, v, uv_step);
+    yuv_row_to_bgr_planes(src, u, v, uv_step, b, g, r, n);
+    break;
+  }
+  case PixelFormat::GRAY8:
+    std::copy(src, src + n, b);
+    std::copy(src, src + n, g);
+    std::copy(src, src + n, r);
+    break;
+  }
+}
+
+/* writes row y of img, counted from its top, as packed RGB24 */
+inline void image_row_to_rgb24(const Image & img, int y, unsigned char * dst) {
+  const int n = img.dx();
+  const unsigned char * src = img.planes[0] + (size_t)y * img.strides[0];
+
+  switch (img.format) {
+  case PixelFormat::RGB24:
+    std::copy(src, src + 3 * n, dst);
+    break;
+  case PixelFormat::BGR24:
+    for (int i = 0; i < n; i++, src += 3, dst += 3) {
+      dst[0] = src[2];
+      dst[1] = src[1];
+      dst[2] = src[0];
+    }
+    break;
+  case PixelFormat::I420:
+  case PixelFormat::NV12: {
+    const unsigned char * u;
+    const unsigned char * v;
+    int uv_step;
+    chroma_rows(img, y, u, v, uv_step);
+    yuv_row_to_rgb24(src, u, v, uv_step, dst, n);
+    break;
+  }
+  case PixelFormat::GRAY8:
+    for (int i = 0; i < n; i++, dst += 3) {
+      dst[0] = dst[1] = dst[2] = src[i];
+    }
+    break;
+  }
+}
+
+}
+
+/*
+ * writes img into dst as b, g, r planes in one pass per row, whatever its
+ * pixel format, so frames never need converting to RGB first.
+ */
+inline void image_to_planar_bgr(const Image & img, unsigned char * dst) {
+  if (img.format == PixelFormat::RGB24) {
+    rgb24_to_planar_bgr(img.rgb24(), dst);
+    return;
+  }
+
+  const int width = img.dx();
+  const int height = img.dy();
+  const size_t plane = (size_t)width * height;
+
+  for (int y = 0; y < height; y++) {
+    unsigned char * b = dst + (size_t)y * width;
+    pixel_convert::image_row_to_bgr_planes(img, y, b, b + plane, b + 2 * plane);
+  }
+}
+
+/* writes img as packed RGB24 rows dst_stride bytes apart */
+inline void image_to_rgb24(const Image & img, unsigned char * dst, int dst_stride) {
+  for (int y = 0; y < img.dy(); y++) {
+    pixel_convert::image_row_to_rgb24(img, y, dst + (size_t)y * dst_stride);
+  }
+}
+
+/*
+ * rgb24_resize_to_planar_bgr for any pixel format.  source rows are
+ * converted as the resampler reaches them, two at a time, rather than
+ * converting the whole image up front.
+ */
+inline void image_resize_to_planar_bgr(const Image & img, unsigned char * dst, int out_width, int out_height) {
+  if (img.format == PixelFormat::RGB24) {
+    rgb24_resize_to_planar_bgr(img.rgb24(), dst, out_width, out_height);
+    return;
+  }
+
+  const int width = img.dx();
+  const int height = img.dy();
+  if (width == out_width && height == out_height) {
+    image_to_planar_bgr(img, dst);
+    return;
+  }
+
+  // consecutive rows land in different slots, so the pair in use is never evicted
+  std::vector<unsigned char> rows(2 * 3 * (size_t)width);
+  int cached[2] = {-1, -1};
+  pixel_convert::resize_rows_to_planar_bgr(width, height, [&](int y) {
+    unsigned char * row = &rows[(y & 1) * 3 * (size_t)width];
+    if (cached[y & 1] != y) {
+      pixel_convert::image_row_to_rgb24(img, y, row);
+      cached[y & 1] = y;
+    }
+    return (const unsigned char *)row;
+  }, dst, out_width, out_height);
+}
+
+namespace pixel_convert {
+
+/* adds n bytes of src into the 16 bit sums */
+inline void accumulate_row(const unsigned char * src, uint16_t * sum, int n) {
+  int i = 0;
+#if defined(PIXEL_CONVERT_X86)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    __m128i * s = reinterpret_cast<__m128i *>(sum + i);
+    _mm_storeu_si128(s, _mm_add_epi16(_mm_loadu_si128(s), _mm_unpacklo_epi8(v, zero)));
+    _mm_storeu_si128(s + 1, _mm_add_epi16(_mm_loadu_si128(s + 1), _mm_unpackhi_epi8(v, zero)));
+  }
+#elif defined(PIXEL_CONVERT_NEON)
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(src + i);
+    vst1q_u16(sum + i, vaddw_u8(vld1q_u16(sum + i), vget_low_u8(v)));
+    vst1q_u16(sum + i + 8, vaddw_u8(vld1q_u16(sum + i + 8), vget_high_u8(v)));
+  }
+#endif
+  for (; i < n; i++) {
+    sum[i] += src[i];
+  }
+}
+
+}
+
+/*
+ * RowScaler shrinks a packed RGB24 image one output row at a time, so a
+ * scaled copy of the whole image never exists.  row(y, src) returns output
+ * row y, and src(i) must return source row i as packed RGB24.  output rows
+ * are requested in increasing order, src is called with non-decreasing i,
+ * and the last two rows it returned must stay valid.
+ *
+ * shrinking by 2 or more averages every source pixel under an output
+ * pixel (a box filter) with the source rows summed by SIMD adds.  smaller
+ * factors resample bilinearly, the same way rgb24_resize_to_planar_bgr
+ * does.
+ */
+class RowScaler {
+  int width, height, out_width, out_height;
+  bool box;
+  // first source column/row of every output column/row, plus one past the end
+  std::vector<int> x0, y0;
+  // bilinear offsets and 11 bit weights
+  std::vector<int> xoff, xweight;
+  std::vector<uint16_t> sums;
+  std::vector<unsigned char> out;
+
+  static const int shift = 11;
+public:
+  RowScaler(int width, int height, int out_width, int out_height)
+    : width(width), height(height), out_width(out_width), out_height(out_height),
+      // 16 bit sums hold up to 257 rows of 255
+      box(width >= 2 * out_width && height >= 2 * out_height && (height + out_height - 1) / out_height <= 256),
+      out(3 * (size_t)out_width)
+  {
+    if (box) {
+      x0.resize(out_width + 1);
+      for (int x = 0; x <= out_width; x++) {
+        x0[x] = (int)((int64_t)x * width / out_width);
+      }
+      y0.resize(out_height + 1);
+      for (int y = 0; y <= out_height; y++) {
+        y0[y] = (int)((int64_t)y * height / out_height);
+      }
+      sums.resize(3 * (size_t)width);
+      return;
+    }
+
+    const int one = 1 << shift;
+    xoff.resize(out_width);
+    xweight.resize(out_width);
+    const float sx = (float)width / out_width;
+    for (int x = 0; x < out_width; x++) {
+      float fx = std::max(0.f, (x + 0.5f) * sx - 0.5f);
+      int ix = std::min((int)fx, width - 1);
+      xoff[x] = ix;
+      xweight[x] = ix + 1 < width ? (int)((fx - ix) * one) : 0;
+    }
+  }
+
+  bool is_box() const {
+    return box;
+  }
+
+  template<typename SrcFn>
+  const unsigned char * row(int y, SrcFn src) {
+    unsigned char * dst = out.data();
+
+    if (box) {
+      std::fill(sums.begin(), sums.end(), 0);
+      const int rows = y0[y + 1] - y0[y];
+      for (int i = y0[y]; i < y0[y + 1]; i++) {
+        pixel_convert::accumulate_row(src(i), sums.data(), 3 * width);
+      }
+      for (int x = 0; x < out_width; x++, dst += 3) {
+        const uint32_t area = (uint32_t)(x0[x + 1] - x0[x]) * rows;
+        uint32_t s[3] = {0, 0, 0};
+        for (int i = x0[x]; i < x0[x + 1]; i++) {
+          s[0] += sums[3 * i];
+          s[1] += sums[3 * i + 1];
+          s[2] += sums[3 * i + 2];
+        }
+        for (int c = 0; c < 3; c++) {
+          dst[c] = (unsigned char)((s[c] + area / 2) / area);
+        }
+      }
+      return out.data();
+    }
+
+    const int one = 1 << shift;
+    const float sy = (float)height / out_height;
+    float fy = std::max(0.f, (y + 0.5f) * sy - 0.5f);
+    int iy = std::min((int)fy, height - 1);
+    int wy = iy + 1 < height ? (int)((fy - iy) * one) : 0;
+
+    const unsigned char * row0 = src(iy);
+    const unsigned char * row1 = wy ? src(iy + 1) : row0;
+    for (int x = 0; x < out_width; x++, dst += 3) {
+      const unsigned char * p0 = row0 + 3 * xoff[x];
+      const unsigned char * p1 = row1 + 3 * xoff[x];
+      const int wx = xweight[x];
+      const int dx = wx ? 3 : 0;
+      for (int c = 0; c < 3; c++) {
+        int top = p0[c] * (one - wx) + p0[c + dx] * wx;
+        int bottom = p1[c] * (one - wx) + p1[c + dx] * wx;
+        dst[c] = (unsigned char)((top * (one - wy) + bottom * wy + (1 << (2 * shift - 1))) >> (2 * shift));
+      }
+    }
+    return out.data();
+  }
+};
@@ -0,0 +1,407 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "image.hpp"
+
+/* one frame read from a ShmRing, pin keeps its slot from being rewritten */
+struct ShmFrame {
+  uint64_t sequence;
+  uint64_t timestamp;
+  Image image;
+  std::shared_ptr<void> pin;
+
+  ShmFrame()
+    : sequence(0), timestamp(0)
+  { }
+};
+
+/*
+ * ShmRing passes frames from a capture process to the detector through a
+ * POSIX shared memory object, without copying them on the way.
+ *
+ * the producer fills a free slot in place and publishes it as the latest
+ * frame.  the reader always takes the latest frame, so when it falls behind
+ * older frames are skipped rather than queued.  a frame the reader holds
+ * is pinned and its slot is left alone until the pin is dropped; if every
+ * slot is pinned or just published, the producer drops the new frame.
+ * with slots for the latest frame, the frame being written and one per
+ * pinned frame, nothing is dropped on the producer side.
+ *
+ * the reader sleeps on a futex in the shared header and the producer only
+ * makes the wake up call when someone is waiting.  the producer's
+ * destructor marks the ring closed and removes the name.
+ *
+ * one producer and one reader per ring.  pins held by a reader that dies
+ * stay taken until the producer recreates the ring.
+ */
+class ShmRing {
+  static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+                "the ring shares atomics between processes, they must be lock free");
+public:
+  struct stats {
+    // written by the producer, shared
+    uint64_t published;
+    uint64_t dropped;
+    // counted by this reader
+    uint64_t read;
+    uint64_t skipped;
+  };
+private:
+  static const uint32_t version = 1;
+  static const uint32_t writing = 0x80000000u;
+
+  struct slot_header {
+    // number of pins, or writing while the producer fills the slot
+    std::atomic<uint32_t> state;
+    std::atomic<uint64_t> sequence;
+    uint64_t timestamp;
+  };
+
+  struct ring_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t slot_size;
+    uint64_t slots_offset;
+
+    // (sequence << 16) | slot of the latest frame, 0 before the first
+    std::atomic<uint64_t> latest;
+    // bumped on every publish, the futex word readers sleep on
+    std::atomic<uint32_t> notify;
+    std::atomic<uint32_t> waiters;
+    std::atomic<uint32_t> closed;
+
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> dropped;
+  };
+
+  struct mapping {
+    void * base;
+    size_t length;
+
+    mapping(void * base, size_t length)
+      : base(base), length(length)
+    { }
+    ~mapping() {
+      munmap(base, length);
+    }
+  };
+
+  std::string name;
+  bool owner;
+  std::shared_ptr<mapping> map;
+  ring_header * header;
+  slot_header * slots;
+  uint64_t next_sequence;
+
+  // reader side
+  uint64_t last_read;
+  uint64_t reads;
+  uint64_t skips;
+
+  static std::runtime_error error(std::string const & what, std::string const & name) {
+    return std::runtime_error(what + " " + name + ": " + std::strerror(errno));
+  }
+
+  static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+  }
+
+  ShmRing(std::string const & name, bool owner, int fd, size_t length)
+    : name(name), owner(owner), header(nullptr), slots(nullptr), next_sequence(1),
+      last_read(0), reads(0), skips(0)
+  {
+    void * p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      throw error("can't map", name);
+    }
+    close(fd);
+    map = std::make_shared<mapping>(p, length);
+    header = static_cast<ring_header *>(p);
+    slots = reinterpret_cast<slot_header *>(header + 1);
+  }
+
+  unsigned char * slot_data(uint32_t i) const {
+    return static_cast<unsigned char *>(map->base) + header->slots_offset + i * header->slot_size;
+  }
+
+  void wake() {
+    // seq_cst on both sides: the bump of notify must not pass the load of
+    // waiters here, nor the reader's futex check of notify its increment of
+    // waiters, or each can miss the other and the reader sleeps through
+    header->notify.fetch_add(1, std::memory_order_seq_cst);
+    if (header->waiters.load(std::memory_order_seq_cst) > 0) {
+#ifdef __linux__
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->notify), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+    }
+  }
+
+  /* sleeps until notify moves on from seen, or timeout_ms passes */
+  void wait(uint32_t seen, int timeout_ms) {
+    header->waiters.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+    timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&header->notify), FUTEX_WAIT, seen,
+            timeout_ms >= 0 ? &ts : nullptr, nullptr, 0);
+#else
+    (void)seen;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+    header->waiters.fetch_sub(1, std::memory_order_acq_rel);
+  }
+public:
+  /*
+   * creates the ring name (as for shm_open, e.g. "/faces") for width x height
+   * frames in format, replacing any previous ring of that name.
+   */
+  static std::unique_ptr<ShmRing> create(std::string const & name, int width, int height,
+                                         PixelFormat format, size_t slot_count = 4) {
+    if (slot_count < 2 || slot_count > 0xffff) {
+      throw std::invalid_argument("a shared memory ring needs between 2 and 65535 slots");
+    }
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t slot_size = round_up(image_bytes(format, width, height), page);
+    const size_t slots_offset = round_up(sizeof(ring_header) + slot_count * sizeof(slot_header), page);
+    const size_t length = slots_offset + slot_count * slot_size;
+
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      throw error("can't create shared memory", name);
+    }
+    if (ftruncate(fd, length) != 0) {
+      close(fd);
+      shm_unlink(name.c_str());
+      throw error("can't size shared memory", name);
+    }
+
+    std::unique_ptr<ShmRing> ret(new ShmRing(name, true, fd, length));
+    ring_header * h = new (ret->header) ring_header();
+    h->version = version;
+    h->slot_count = (uint32_t)slot_count;
+    h->width = width;
+    h->height = height;
+    h->format = (uint32_t)format;
+    h->slot_size = slot_size;
+    h->slots_offset = slots_offset;
+    h->latest = 0;
+    h->notify = 0;
+    h->waiters = 0;
+    h->closed = 0;
+    h->published = 0;
+    h->dropped = 0;
+    for (size_t i = 0; i < slot_count; i++) {
+      slot_header * s = new (&ret->slots[i]) slot_header();
+      s->state = 0;
+      s->sequence = 0;
+      s->timestamp = 0;
+    }
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(h->magic, "FACERNG", 8);
+    return ret;
+  }
+
+  /* attaches to a ring another process created */
+  static std::unique_ptr<ShmRing> open(std::string const & name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      throw error("can't open shared memory", name);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ring_header)) {
+      close(fd);
+      throw std::runtime_error("shared memory " + name + " is not a frame ring");
+    }
+
+    std::unique_ptr<ShmRing> ret(new ShmRing(name, false, fd, st.st_size));
+    ring_header * h = ret->header;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (std::memcmp(h->magic, "FACERNG", 8) != 0 || h->version != version ||
+        h->slots_offset + h->slot_count * h->slot_size > (uint64_t)st.st_size) {
+      throw std::runtime_error("shared memory " + name + " is not a frame ring");
+    }
+    ret->last_read = h->latest.load(std::memory_order_acquire) >> 16;
+    return ret;
+  }
+
+  ~ShmRing() {
+    if (owner) {
+      header->closed.store(1, std::memory_order_release);
+      wake();
+      shm_unlink(name.c_str());
+    }
+  }
+  ShmRing(ShmRing const &) = delete;
+  ShmRing & operator=(ShmRing const &) = delete;
+
+  int get_width() const {
+    return header->width;
+  }
+  int get_height() const {
+    return header->height;
+  }
+  PixelFormat get_format() const {
+    return (PixelFormat)header->format;
+  }
+  size_t get_slot_count() const {
+    return header->slot_count;
+  }
+  /* true once the producer has gone, frames published before may still be read */
+  bool is_closed() const {
+    return header->closed.load(std::memory_order_acquire) != 0;
+  }
+
+  /*
+   * producer: reserves a slot to write the next frame into and returns its
+   * index, or -1 when every slot is in use, in which case the frame is
+   * counted as dropped.  the slot's pixels are image(slot).
+   */
+  int acquire() {
+    const uint64_t latest = header->latest.load(std::memory_order_acquire);
+    const uint32_t latest_slot = latest != 0 ? (uint32_t)(latest & 0xffff) : header->slot_count;
+
+    // the reader may pin a slot between the scan and the claim, then try again
+    for (uint32_t attempt = 0; attempt < header->slot_count; attempt++) {
+      // the oldest free slot other than the latest frame
+      int best = -1;
+      uint64_t best_sequence = 0;
+      for (uint32_t i = 0; i < header->slot_count; i++) {
+        if (i == latest_slot || slots[i].state.load(std::memory_order_acquire) != 0) {
+          continue;
+        }
+        uint64_t sequence = slots[i].sequence.load(std::memory_order_relaxed);
+        if (best < 0 || sequence < best_sequence) {
+          best = i;
+          best_sequence = sequence;
+        }
+      }
+      if (best < 0) {
+        break;
+      }
+      uint32_t expected = 0;
+      if (slots[best].state.compare_exchange_strong(expected, writing, std::memory_order_acq_rel)) {
+        return best;
+      }
+    }
+    header->dropped.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+  }
+
+  /* a writable view of slot */
+  Image image(int slot) const {
+    return Image::wrap(get_format(), slot_data(slot), get_width(), get_height());
+  }
+
+  /* producer: makes the frame in slot the latest one and wakes the reader */
+  void publish(int slot, uint64_t timestamp) {
+    const uint64_t sequence = next_sequence++;
+    slots[slot].timestamp = timestamp;
+    slots[slot].sequence.store(sequence, std::memory_order_relaxed);
+    slots[slot].state.store(0, std::memory_order_release);
+    header->latest.store(sequence << 16 | (uint64_t)slot, std::memory_order_release);
+    header->published.fetch_add(1, std::memory_order_relaxed);
+    wake();
+  }
+
+  /* producer: copies one tightly packed frame in, returns false if it was dropped */
+  bool push(unsigned char const * frame, uint64_t timestamp) {
+    int slot = acquire();
+    if (slot < 0) {
+      return false;
+    }
+    std::memcpy(slot_data(slot), frame, image_bytes(get_format(), get_width(), get_height()));
+    publish(slot, timestamp);
+    return true;
+  }
+
+  /*
+   * reader: waits up to timeout_ms (forever when negative) for a frame newer
+   * than the last one read and pins it.  returns false on timeout, or once
+   * the producer has closed the ring and no newer frame is left.
+   */
+  bool read(ShmFrame & frame, int timeout_ms = -1) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while (true) {
+      const uint32_t seen = header->notify.load(std::memory_order_acquire);
+      const uint64_t latest = header->latest.load(std::memory_order_acquire);
+      const uint64_t sequence = latest >> 16;
+
+      if (sequence > last_read) {
+        const uint32_t slot = (uint32_t)(latest & 0xffff);
+        std::atomic<uint32_t> & state = slots[slot].state;
+        uint32_t s = state.load(std::memory_order_acquire);
+        if ((s & writing) == 0 && state.compare_exchange_strong(s, s + 1, std::memory_order_acq_rel)) {
+          if (slots[slot].sequence.load(std::memory_order_acquire) == sequence) {
+            skips += sequence - last_read - 1;
+            reads++;
+            last_read = sequence;
+
+            std::shared_ptr<mapping> keep = map;
+            frame.sequence = sequence;
+            frame.timestamp = slots[slot].timestamp;
+            frame.image = Image::wrap(get_format(), slot_data(slot), get_width(), get_height());
+            frame.pin = std::shared_ptr<void>(nullptr, [keep, &state](void *) {
+              state.fetch_sub(1, std::memory_order_acq_rel);
+            });
+            return true;
+          }
+          // rewritten between reading latest and pinning it
+          state.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        continue;
+      }
+
+      if (header->closed.load(std::memory_order_acquire)) {
+        return false;
+      }
+      int remaining = -1;
+      if (timeout_ms >= 0) {
+        remaining = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0) {
+          return false;
+        }
+      }
+      wait(seen, remaining);
+    }
+  }
+
+  stats get_stats() const {
+    return stats{header->published.load(), header->dropped.load(), reads, skips};
+  }
+};
+
+static std::ostream &operator<<(std::ostream &os, ShmRing::stats const & s) {
+  os << "ring published: " << s.published << " dropped: " << s.dropped
+     << " read: " << s.read << " skipped: " << s.skipped;
+  return os;
+}
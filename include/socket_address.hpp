@@ -0,0 +1,196 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/*
+ * SocketAddress names a stream socket the way the command line does:
+ *
+ *   unix:/run/faces.sock    Unix domain socket
+ *   tcp:host:port           TCP, "tcp:" may be left out
+ *   :port                   TCP on every interface (listen) or localhost (connect)
+ */
+struct SocketAddress {
+  bool local;
+  std::string path;
+  std::string host;
+  std::string port;
+
+  SocketAddress()
+    : local(false)
+  { }
+
+  static SocketAddress parse(std::string const & text) {
+    SocketAddress ret;
+    if (text.compare(0, 5, "unix:") == 0) {
+      ret.local = true;
+      ret.path = text.substr(5);
+      if (ret.path.empty() || ret.path.size() >= sizeof(((sockaddr_un *)nullptr)->sun_path)) {
+        throw std::invalid_argument("bad unix socket path in '" + text + "'");
+      }
+      return ret;
+    }
+
+    std::string rest = text.compare(0, 4, "tcp:") == 0 ? text.substr(4) : text;
+    auto colon = rest.rfind(':');
+    if (colon == std::string::npos || colon + 1 == rest.size()) {
+      throw std::invalid_argument("socket address '" + text + "' needs a port");
+    }
+    ret.host = rest.substr(0, colon);
+    ret.port = rest.substr(colon + 1);
+    return ret;
+  }
+
+  std::string to_string() const {
+    return local ? "unix:" + path : "tcp:" + host + ":" + port;
+  }
+
+  /* returns a socket listening on this address, an existing unix socket file is replaced */
+  int listen(int backlog = 16) const {
+    if (local) {
+      sockaddr_un sa = unix_address();
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) {
+        throw error("can't create socket for");
+      }
+      unlink(path.c_str());
+      if (bind(fd, (sockaddr *)&sa, sizeof(sa)) != 0 || ::listen(fd, backlog) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        throw error("can't listen on");
+      }
+      return fd;
+    }
+
+    addrinfo * res = resolve(AI_PASSIVE);
+    int fd = -1;
+    for (addrinfo * ai = res; ai != nullptr && fd < 0; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) {
+        continue;
+      }
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      if (bind(fd, ai->ai_addr, ai->ai_addrlen) != 0 || ::listen(fd, backlog) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        fd = -1;
+      }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+      throw error("can't listen on");
+    }
+    return fd;
+  }
+
+  /* returns a socket connected to this address */
+  int connect() const {
+    if (local) {
+      sockaddr_un sa = unix_address();
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) {
+        throw error("can't create socket for");
+      }
+      if (::connect(fd, (sockaddr *)&sa, sizeof(sa)) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        throw error("can't connect to");
+      }
+      return fd;
+    }
+
+    addrinfo * res = resolve(0);
+    int fd = -1;
+    for (addrinfo * ai = res; ai != nullptr && fd < 0; ai = ai->ai_next) {
+      fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        fd = -1;
+      }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+      throw error("can't connect to");
+    }
+    // frames are large, but headers are not and must not wait for the next frame
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+  }
+private:
+  std::runtime_error error(std::string const & what) const {
+    return std::runtime_error(what + " " + to_string() + ": " + std::strerror(errno));
+  }
+
+  sockaddr_un unix_address() const {
+    sockaddr_un sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    std::strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+    return sa;
+  }
+
+  addrinfo * resolve(int flags) const {
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+
+    addrinfo * res = nullptr;
+    int rc = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0) {
+      throw std::runtime_error("can't resolve " + to_string() + ": " + gai_strerror(rc));
+    }
+    return res;
+  }
+};
+
+/* reads exactly size bytes, returns false on a clean end of stream before the first byte */
+inline bool read_fully(int fd, void * buffer, size_t size) {
+  unsigned char * p = static_cast<unsigned char *>(buffer);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = recv(fd, p + done, size - done, MSG_WAITALL);
+    if (n > 0) {
+      done += n;
+    } else if (n == 0) {
+      if (done == 0) {
+        return false;
+      }
+      throw std::runtime_error("connection closed mid frame");
+    } else if (errno != EINTR) {
+      throw std::runtime_error(std::string("read failed: ") + std::strerror(errno));
+    }
+  }
+  return true;
+}
+
+/* writes all of buffer, a closed peer is an error rather than SIGPIPE */
+inline void write_fully(int fd, void const * buffer, size_t size) {
+  unsigned char const * p = static_cast<unsigned char const *>(buffer);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = send(fd, p + done, size - done, MSG_NOSIGNAL);
+    if (n > 0) {
+      done += n;
+    } else if (n < 0 && errno != EINTR) {
+      throw std::runtime_error(std::string("write failed: ") + std::strerror(errno));
+    }
+  }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "backoff.hpp"
+
+/*
+ * SpscRing is a bounded lock-free queue for exactly one producer thread and
+ * one consumer thread.  the capacity is rounded up to a power of two.
+ *
+ * the producer calls close() after its last push; pop() keeps returning the
+ * remaining items and fails once the ring is closed and drained.  waiting
+ * works as in MpmcQueue.
+ */
+template<typename T> class SpscRing {
+  std::vector<T> slots;
+  size_t mask;
+
+  // producer and consumer state live on separate cache lines
+  char pad0[64];
+  std::atomic<size_t> tail;
+  size_t cached_head;
+  char pad1[64];
+  std::atomic<size_t> head;
+  size_t cached_tail;
+  char pad2[64];
+  std::atomic<bool> closed;
+  // consumers waiting for an item and producers waiting for room
+  EventCount not_empty;
+  EventCount not_full;
+
+  static size_t round_up(size_t n) {
+    size_t p = 2;
+    while (p < n) {
+      p <<= 1;
+    }
+    return p;
+  }
+public:
+  SpscRing(size_t capacity)
+    : slots(round_up(capacity)), mask(slots.size() - 1),
+      tail(0), cached_head(0), head(0), cached_tail(0), closed(false)
+  { }
+
+  bool try_push(T & item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cached_head == slots.size()) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (t - cached_head == slots.size()) {
+        return false;
+      }
+    }
+    slots[t & mask] = std::move(item);
+    tail.store(t + 1, std::memory_order_release);
+    not_empty.notify();
+    return true;
+  }
+  bool try_pop(T & item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == cached_tail) {
+      cached_tail = tail.load(std::memory_order_acquire);
+      if (h == cached_tail) {
+        return false;
+      }
+    }
+    item = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    not_full.notify();
+    return true;
+  }
+  /* waits for room, returns false if the ring was closed */
+  bool push(T item) {
+    Backoff backoff;
+    while (!closed.load(std::memory_order_acquire)) {
+      if (try_push(item)) {
+        return true;
+      }
+      if (backoff.pause()) {
+        continue;
+      }
+      uint64_t key = not_full.prepare_wait();
+      if (closed.load(std::memory_order_acquire)) {
+        not_full.cancel_wait();
+        break;
+      }
+      if (try_push(item)) {
+        not_full.cancel_wait();
+        return true;
+      }
+      not_full.wait(key);
+    }
+    return false;
+  }
+  /* waits for an item, returns false once the ring is closed and drained */
+  bool pop(T & item) {
+    Backoff backoff;
+    while (true) {
+      if (try_pop(item)) {
+        return true;
+      }
+      if (closed.load(std::memory_order_acquire)) {
+        // anything pushed before close() is visible now
+        return try_pop(item);
+      }
+      if (backoff.pause()) {
+        continue;
+      }
+      uint64_t key = not_empty.prepare_wait();
+      if (try_pop(item)) {
+        not_empty.cancel_wait();
+        return true;
+      }
+      if (closed.load(std::memory_order_acquire)) {
+        not_empty.cancel_wait();
+        return try_pop(item);
+      }
+      not_empty.wait(key);
+    }
+  }
+  void close() {
+    closed.store(true, std::memory_order_release);
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+  bool is_closed() const {
+    return closed.load(std::memory_order_acquire);
+  }
+  size_t size() const {
+    return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+  }
+  size_t get_capacity() const {
+    return slots.size();
+  }
+};
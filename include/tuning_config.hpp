@@ -0,0 +1,115 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "face_detector.hpp"
+#include "facenet.hpp"
+
+/*
+ * TuningConfig holds the settings autotune found fastest on a machine, and
+ * reads and writes them as "key=value" lines (# starts a comment):
+ *
+ *   device=CPU
+ *   detector.requests=4
+ *   detector.streams=2
+ *   facenet.batch=8
+ *   facenet.streams=1
+ *
+ * keys that are missing, or 0, leave the corresponding option untouched.
+ */
+struct TuningConfig {
+  std::string device;
+  size_t detector_requests;
+  size_t detector_streams;
+  size_t facenet_batch;
+  size_t facenet_streams;
+
+  TuningConfig()
+    : detector_requests(0), detector_streams(0), facenet_batch(0), facenet_streams(0)
+  { }
+
+  static TuningConfig load(std::string const & filename) {
+    std::ifstream fs(filename);
+    if (!fs) {
+      throw std::runtime_error("can't open tuning file " + filename);
+    }
+
+    TuningConfig ret;
+    std::string line;
+    while (std::getline(fs, line)) {
+      line = line.substr(0, line.find('#'));
+      auto eq = line.find('=');
+      if (eq == std::string::npos) {
+        continue;
+      }
+      std::string key = line.substr(0, eq);
+      key.erase(key.find_last_not_of(" \t") + 1);
+      key.erase(0, key.find_first_not_of(" \t"));
+      std::istringstream value(line.substr(eq + 1));
+
+      if (key == "device") {
+        value >> ret.device;
+      } else if (key == "detector.requests") {
+        value >> ret.detector_requests;
+      } else if (key == "detector.streams") {
+        value >> ret.detector_streams;
+      } else if (key == "facenet.batch") {
+        value >> ret.facenet_batch;
+      } else if (key == "facenet.streams") {
+        value >> ret.facenet_streams;
+      } else {
+        std::clog << filename << ": ignoring unknown key " << key << "\n";
+      }
+    }
+    return ret;
+  }
+
+  /* comment is written at the top of the file, one "# " line per line */
+  void save(std::string const & filename, std::string const & comment = std::string()) const {
+    std::ofstream fs(filename, std::ios::out | std::ios::trunc);
+
+    std::istringstream lines(comment);
+    for (std::string line; std::getline(lines, line);) {
+      fs << "# " << line << "\n";
+    }
+    fs << "device=" << device << "\n"
+       << "detector.requests=" << detector_requests << "\n"
+       << "detector.streams=" << detector_streams << "\n"
+       << "facenet.batch=" << facenet_batch << "\n"
+       << "facenet.streams=" << facenet_streams << "\n";
+
+    fs.close();
+    if (fs.fail()) {
+      throw std::runtime_error("can't write tuning file " + filename);
+    }
+  }
+
+  /* settings tuned on another device are ignored */
+  void apply(std::string const & plugin_name, DetectorOptions & options) const {
+    if (plugin_name != device) {
+      std::clog << "tuning is for " << device << ", not " << plugin_name << "\n";
+      return;
+    }
+    if (detector_requests > 0) {
+      options.num_requests = detector_requests;
+    }
+    if (detector_streams > 0) {
+      options.cpu_streams = detector_streams;
+    }
+  }
+  void apply(std::string const & plugin_name, FacenetOptions & options) const {
+    if (plugin_name != device) {
+      std::clog << "tuning is for " << device << ", not " << plugin_name << "\n";
+      return;
+    }
+    if (facenet_batch > 0) {
+      options.max_batch = facenet_batch;
+    }
+    if (facenet_streams > 0) {
+      options.cpu_streams = facenet_streams;
+    }
+  }
+};
@@ -0,0 +1,26 @@
+#include "inference_context_wrapper.h"
+#include "inference_context.hpp"
+
+void inference_context_options_init(inference_context_options * opts) {
+  opts->plugin_path = nullptr;
+  opts->cpu_threads = 0;
+  opts->cpu_bind_threads = 1;
+}
+
+inference_context * inference_context_create(const inference_context_options * opts) {
+  InferenceContextOptions options;
+  if (opts != nullptr) {
+    if (opts->plugin_path != nullptr) {
+      options.plugin_path = opts->plugin_path;
+    }
+    if (opts->cpu_threads > 0) {
+      options.cpu_threads = opts->cpu_threads;
+    }
+    options.cpu_bind_threads = opts->cpu_bind_threads != 0;
+  }
+  return new inference_context{std::make_shared<InferenceContext>(options)};
+}
+
+void inference_context_destroy(inference_context * c) {
+  delete c;
+}
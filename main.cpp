@@ -1,3 +1,5 @@
+#include <chrono>
+#include <csignal>
 #include <iostream>
 #include <fstream>
 #include <iomanip>
@@ -6,28 +8,40 @@
 #include <sstream>
 #include <algorithm>
 #include <random>
-#include "write_jpeg.hpp"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "crop_archive.hpp"
+#include "crop_writer.hpp"
+#include "embedding_sink.hpp"
 #include "face_detector.hpp"
 #include "facenet.hpp"
 #include "multimodal.hpp"
+#include "pipeline.hpp"
+#include "command_line.hpp"
+#include "buffer_pool.hpp"
+#include "inference_context.hpp"
+#include "tuning_config.hpp"
+#include "frame_file.hpp"
+#include "frame_server.hpp"
+#include "shm_ring.hpp"
 
 using std::min;
 using std::max;
 
-template<typename T>
-void write_embedding(std::string filename, std::vector<T> const & embedding) {
+// set by the first SIGINT/SIGTERM, which ends the input so that the
+// pipeline drains and the archive closes its segment; a second one kills
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void on_signal(int sig) {
+  interrupted = 1;
+  std::signal(sig, SIG_DFL);
+}
+
+void write_embedding(std::string filename, std::vector<float> const & embedding) {
   std::ofstream fs;
   fs.open(filename, std::ios::out | std::ios::trunc);
-  
-  fs << "[";
-  for (auto i = embedding.begin(); i != embedding.end(); i++) {
-    if (i != embedding.begin()) {
-      fs << ", ";
-    }
-    fs << *i;
-  }
-  fs << "]";
-
+  write_json_array(fs, embedding);
   fs.close();
 }
 
@@ -61,128 +75,349 @@ int main(int ac, char *av[]) {
   // mm.print_categories(std::cout);
   return 0;
 */
-  std::string plugin_name = "CPU";
-  if (ac > 1) {
-    plugin_name = av[1];
-    std::clog << plugin_name;
-  } else {
-    plugin_name = "CPU";
-  }
-
-  std::istream * in = &std::cin;
-  bool need_io_cleanup = false;
-  if (ac > 2) {
-    std::ifstream * fs = new std::ifstream();
-    fs->open(av[2], std::ios::in);
-    in = fs;
-    need_io_cleanup = true;
+  CommandLine cmd(ac, av);
+
+  std::string plugin_name = cmd.positional(0, "CPU");
+  std::clog << plugin_name;
+
+  PipelineOptions options;
+  options.detector_threads = cmd.get<size_t>("detector-threads", 1);
+  options.embed_threads = cmd.get<size_t>("embed-threads", 1);
+  options.writer_threads = cmd.get<size_t>("writer-threads", 1);
+  options.queue_depth = cmd.get<size_t>("queue-depth", 8);
+  // --embed-delay-ms=20 waits up to 20ms for a full embedding batch
+  options.embed_delay_ms = cmd.get<size_t>("embed-delay-ms", 0);
+  // --live works on the newest frame and drops the rest, for cameras; the default processes every frame
+  options.live = cmd.get("live", false);
+
+  // frames in flight on each detector while the next one is being read
+  const size_t num_requests = cmd.get<size_t>("requests", 2);
+  // faces embedded by one facenet inference
+  const size_t max_batch = cmd.get<size_t>("batch", plugin_name == "MYRIAD" ? 1 : 8);
+
+  // latency, throughput or balanced, see PerformanceProfile
+  const PerformanceProfile profile = parse_performance_profile(cmd.get("profile", "default"));
+
+  // settings written by autotune, applied over --requests and --batch
+  TuningConfig tuning;
+  const bool tuned = cmd.has("tuning");
+  if (tuned) {
+    tuning = TuningConfig::load(cmd.get("tuning", ""));
   }
 
-  Facenet * facenet = nullptr;
-
-  FaceDetector detector;
+  // compiled networks are kept here between runs when set
+  const std::string cache_dir = cmd.get("cache-dir", "");
 
-  if (plugin_name == "MYRIAD") {
-    detector = FaceDetector(
-      "../face-detection-model/FP16/face-detection-adas-0001.xml",
-      "../face-detection-model/FP16/face-detection-adas-0001.bin",
-      "MYRIAD",
-      "/opt/intel/openvino/deployment_tools/inference_engine/lib/");
+  const std::string plugin_path = "/opt/intel/openvino/deployment_tools/inference_engine/lib/";
 
-    facenet = new Facenet(
-      "../resnet50_128_caffe/FP16/resnet50_128.xml",
-      "../resnet50_128_caffe/FP16/resnet50_128.bin",
-      "MYRIAD",
-      "/opt/intel/openvino/deployment_tools/inference_engine/lib/");
+  // every detector and facenet runs on the same plugin and CPU thread pool
+  InferenceContextOptions context_options;
+  context_options.plugin_path = plugin_path;
+  context_options.cpu_threads = cmd.get<size_t>("cpu-threads", 0);
+  std::shared_ptr<InferenceContext> context = std::make_shared<InferenceContext>(context_options);
+  const std::string model_precision = plugin_name == "MYRIAD" ? "FP16" : "FP32";
 
-  } else {
-    detector = FaceDetector(
-      "../face-detection-model/FP32/face-detection-adas-0001.xml",
-      "../face-detection-model/FP32/face-detection-adas-0001.bin",
-      "CPU",
-      "/opt/intel/openvino/deployment_tools/inference_engine/lib/");
-
-    facenet = new Facenet(
-      "../resnet50_128_caffe/FP32/resnet50_128.xml",
-      "../resnet50_128_caffe/FP32/resnet50_128.bin",
-      "CPU",
-      "/opt/intel/openvino/deployment_tools/inference_engine/lib/");
+  // --shm=/name reads the latest frame from an shm_producer's ring, which knows its own geometry
+  std::unique_ptr<ShmRing> ring;
+  if (cmd.has("shm")) {
+    ring = ShmRing::open(cmd.get("shm", ""));
+  }
 
+  // geometry and layout of the incoming frames, e.g. --width=672 --height=384 --format=I420
+  const int image_width = ring ? ring->get_width() : cmd.get<int>("width", 1920);
+  const int image_height = ring ? ring->get_height() : cmd.get<int>("height", 1080);
+  const PixelFormat format = ring ? ring->get_format() : parse_pixel_format(cmd.get("format", "RGB24"));
+  const size_t frame_size = image_bytes(format, image_width, image_height);
+  std::clog << "frames: " << image_width << "x" << image_height << " " << to_string(format) << "\n";
+  if (ring) {
+    // slots pinned while queued, in flight on a detector and being read,
+    // plus the producer's latest and next frame
+    const size_t pinned = (options.live ? 1 : options.queue_depth) + std::max<size_t>(options.detector_threads, 1) * num_requests + 1;
+    if (ring->get_slot_count() < pinned + 2) {
+      std::clog << "the ring has " << ring->get_slot_count() << " slots, the producer will drop frames unless it has "
+                << pinned + 2 << " or --queue-depth is lowered\n";
+    }
   }
-  detector.set_min_confidence(0.75);
 
+  auto make_detector = [&]() {
+    DetectorOptions detector_options;
+    detector_options.num_requests = num_requests;
+    detector_options.cache_dir = cache_dir;
+    detector_options.context = context;
+    detector_options.profile = profile;
+    // frames already at the network's input size skip the plugin's preprocessing
+    detector_options.frame_width = image_width;
+    detector_options.frame_height = image_height;
+    if (tuned) {
+      tuning.apply(plugin_name, detector_options);
+    }
+    if (plugin_name != "MYRIAD") {
+      // read frames in place rather than copying each one into a planar blob
+      detector_options.input_layout = Layout::NHWC;
+    }
 
-  // auto image_width = detector.get_image_width();
-  // auto image_height = detector.get_image_height();
-  auto image_width = 1920;
-  auto image_height = 1080;
-  auto num_channels = detector.get_num_channels();
-  char * read_data = new char[image_width * image_height * num_channels];
+    std::unique_ptr<FaceDetector> detector(new FaceDetector(
+      "../face-detection-model/" + model_precision + "/face-detection-adas-0001.xml",
+      "../face-detection-model/" + model_precision + "/face-detection-adas-0001.bin",
+      plugin_name,
+      plugin_path,
+      detector_options));
+    detector->set_min_confidence(0.75);
+    return detector;
+  };
+
+  auto make_facenet = [&]() {
+    FacenetOptions facenet_options;
+    facenet_options.max_batch = max_batch;
+    facenet_options.cache_dir = cache_dir;
+    facenet_options.context = context;
+    facenet_options.profile = profile;
+    if (tuned) {
+      tuning.apply(plugin_name, facenet_options);
+    }
 
-  int max_faces = 1024;
-  int id = 0;
+    return std::unique_ptr<Facenet>(new Facenet(
+      "../resnet50_128_caffe/" + model_precision + "/resnet50_128.xml",
+      "../resnet50_128_caffe/" + model_precision + "/resnet50_128.bin",
+      plugin_name,
+      plugin_path,
+      facenet_options));
+  };
+
+  // frames return to the pool once the last face cut from them is written
+  BufferPool frame_pool(frame_size);
+
+  // a capture file is mapped and its frames used in place, stdin is read frame by frame
+  std::unique_ptr<FrameFile> frame_file;
+  FrameRange range{0, 0};
+  const size_t readahead = options.queue_depth;
+  if (cmd.positional_count() > 1) {
+    frame_file.reset(new FrameFile(cmd.positional(1), image_width, image_height, format));
+
+    // --part=i/n processes the i-th of n equal slices of the file
+    size_t part = 0, parts = 1;
+    char slash = '/';
+    std::istringstream ss(cmd.get("part", "0/1"));
+    if (!(ss >> part >> slash >> parts) || slash != '/' || parts == 0 || part >= parts) {
+      throw std::logic_error("--part must be i/n with i < n");
+    }
+    range = frame_file->split(parts)[part];
+    frame_file->prefetch(range.first, readahead);
+    std::clog << "frames " << range.first << "-" << range.last << " of " << frame_file->get_frame_count() << "\n";
+  }
+  size_t next_frame = range.first;
+
+  // --listen=tcp::9990 or --listen=unix:/run/faces.sock receives frames from frame_client producers
+  std::unique_ptr<FrameServer> server;
+  if (cmd.has("listen")) {
+    FrameServerOptions server_options;
+    server_options.address = cmd.get("listen", "");
+    server_options.max_connections = cmd.get<size_t>("max-streams", 8);
+    // a live pipeline wants the newest frame, not a backlog of older ones
+    server_options.queue_depth = options.live ? 1 : options.queue_depth;
+    server_options.exit_when_idle = cmd.get("until-idle", false);
+    server_options.idle_grace_ms = cmd.get<int>("idle-grace-ms", 2000);
+    // producers may send smaller frames or other formats, never larger ones
+    server_options.max_frame_bytes = cmd.get<size_t>("max-frame-bytes", image_bytes(format, image_width, image_height));
+    server.reset(new FrameServer(server_options, frame_pool));
+  }
 
-  while (in->read(read_data, image_width * image_height * num_channels)) {
-    auto res = detector.InferRGB(read_data, 3 * image_width, 0, 0, image_width, image_height);
+  // a reader of the embeddings that goes away shows up as EPIPE on the
+  // next write, rather than as a SIGPIPE that kills the process
+  std::signal(SIGPIPE, SIG_IGN);
+
+  // --archive=dir appends crops and embeddings to segment files there,
+  // rather than a .jpg and a .json per face.  --archive-flush-ms writes out
+  // records batched that long, 0 waits for a full batch
+  std::unique_ptr<CropArchive> archive;
+  if (cmd.has("archive")) {
+    archive.reset(new CropArchive(cmd.get("archive", ""),
+                                  cmd.get<size_t>("archive-segment-mb", 256) << 20,
+                                  cmd.get<size_t>("archive-batch-kb", 1024) << 10,
+                                  cmd.get<size_t>("archive-flush-ms", 1000)));
+  }
 
-    std::clog << "duration: " << res.duration << "\n";
+  // --embeddings=path streams every embedding there, - for stdout, in
+  // --embedding-format f32, f16 or json, instead of a .json file per face
+  std::unique_ptr<EmbeddingSink> embeddings;
+  if (cmd.has("embeddings")) {
+    embeddings.reset(new EmbeddingSink(cmd.get("embeddings", "-"),
+                                       parse_embedding_format(cmd.get("embedding-format", "f32"))));
+  }
 
-    for (auto & p : res.proposal) {
-      std::clog << "prob = " << p.confidence <<
-        "    (" << p.xmin << "," << p.ymin << ")-(" << p.xmax << "," << p.ymax << ")" << std::endl;
+  auto read_frame = [&](PipelineFrame & frame) {
+    // when the embeddings were the only output and nobody reads them any
+    // more, the frames would only be dropped
+    if (interrupted || (embeddings && embeddings->is_closed() && !archive)) {
+      return false;
+    }
+    if (ring) {
+      // woken now and then to notice a signal
+      ShmFrame latest;
+      while (!ring->read(latest, 100)) {
+        if (interrupted) {
+          return false;
+        }
+        if (ring->is_closed()) {
+          // a frame published just before the close is still read
+          if (!ring->read(latest, 0)) {
+            return false;
+          }
+          break;
+        }
+      }
+      // detected in place, the pipeline copies out the face crops and lets the slot go
+      frame.timestamp = latest.timestamp;
+      frame.pin = std::move(latest.pin);
+      frame.image = latest.image;
+      return true;
+    }
+    if (server) {
+      ReceivedFrame received;
+      if (!server->next(received)) {
+        return false;
+      }
+      frame.stream = received.stream;
+      frame.timestamp = received.timestamp;
+      frame.data = std::move(received.data);
+      frame.image = received.image;
+      return true;
+    }
+    if (frame_file) {
+      if (next_frame >= range.last) {
+        return false;
+      }
+      frame.image = frame_file->frame(next_frame);
+      frame_file->prefetch(next_frame + readahead, 1);
+      next_frame++;
+      return true;
+    }
 
-      int x0 = p.xmin * image_width;
-      int x1 = p.xmax * image_width;
-      int y0 = p.ymin * image_height;
-      int y1 = p.ymax * image_height;
+    frame.data = frame_pool.acquire();
+    if (!std::cin.read((char *)frame.data.data(), frame_size)) {
+      return false;
+    }
+    frame.image = frame.data.image(format, image_width, image_height);
+    return true;
+  };
+
+  // crops are encoded and written off the pipeline's threads
+  CropWriterOptions crop_options;
+  crop_options.threads = cmd.get<size_t>("jpeg-threads", 2);
+  crop_options.queue_depth = cmd.get<size_t>("jpeg-queue", 64);
+  crop_options.policy = parse_drop_policy(cmd.get("jpeg-policy", "block"));
+  crop_options.quality = cmd.get<int>("jpeg-quality", 90);
+  // --thumbnail=160 writes crops no larger than 160 pixels on their longer side
+  crop_options.max_edge = cmd.get<int>("thumbnail", 0);
+  CropWriter crop_writer(crop_options);
+
+  const int max_faces = 1024;
+  std::atomic<int> next_id(0);
+  std::mutex out_mutex;
+
+  auto write_face = [&](PipelineFace & face) {
+    if (!embeddings || !embeddings->is_stdout()) {
+      std::lock_guard<std::mutex> lock(out_mutex);
+      std::cout << face.x0 << "," << face.y0 << "-" << face.x1 << "," << face.y1 << std::endl;
+    }
 
-      if (x0 < 0 || x1 >= image_width || y0 < 0 || y1 >= image_height || x0 >= x1 || y0 >= y1) {
-        continue;
-      }
+    auto record = std::make_shared<CropRecord>();
+    record->frame_id = face.frame->id;
+    record->timestamp = face.frame->timestamp;
+    record->stream = face.frame->stream;
+    record->x0 = face.x0;
+    record->y0 = face.y0;
+    record->x1 = face.x1;
+    record->y1 = face.y1;
+    record->confidence = face.proposal.confidence;
+    record->embedding = std::move(face.embedding);
+    if (embeddings) {
+      embeddings->write(*record);
+    }
 
-      std::cout << x0 << "," << y0 << "-" << x1 << "," << y1 << std::endl;
+    if (archive) {
+      // a face whose crop is dropped or fails to encode is still archived, without a jpeg
+      crop_writer.submit(face.crop, face.frame, [&archive, record](std::vector<unsigned char> const & jpeg) {
+        record->jpeg = jpeg;
+        archive->append(*record);
+      }, [&archive, record] {
+        archive->append(*record);
+      });
+      return;
+    }
 
-      // extract the pixels of the face
-      int width = x1 - x0;
-      int height = y1 - y0;
+    int id = next_id++ % max_faces;
 
-      unsigned char * extracted = new unsigned char[num_channels * width * height];
-      
-      for (int c = 0; c < num_channels; c++) {
-        for(int w = 0, w1 = x0; w1 < x1; w++, w1++) {
-          for(int h = 0, h1 = y0; h1 < y1; h++, h1++) {
-            extracted[h * width * num_channels + w * num_channels + c] =
-              read_data[h1 * image_width * num_channels + w1 * num_channels + c];
-          }
-        }
-      }
+    std::stringstream filename;
+    filename << "output/test" << std::setfill('0') << std::setw(5) << id << ".jpg";
+    crop_writer.submit(face.crop, face.frame, filename.str());
 
-      
-      std::stringstream filename;
+    if (!embeddings) {
       std::stringstream embeddingName;
-
-      filename << "output/test" << std::setfill('0') << std::setw(5) << id << ".jpg";
       embeddingName << "output/test" << std::setfill('0') << std::setw(5) << id << ".json";
-      id = (id + 1) % max_faces;
-      
-      write_jpeg(extracted, height, width, filename.str().c_str(), 90);
-
-      auto res = facenet->InferRGB(extracted, width * 3, 0, 0, width, height);
-
-      write_embedding(embeddingName.str(), res.embedding);
-      
-      
-      delete [] extracted;
+      write_embedding(embeddingName.str(), record->embedding);
     }
-    std::clog << "\n";
-
+  };
+
+  Pipeline pipeline(options, read_frame, make_detector, make_facenet, write_face);
+
+  // stdin is only checked between frames, the other sources are woken
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+  std::atomic<bool> finished(false);
+  std::thread watcher;
+  if (server) {
+    // a signal handler can't stop the server, its next() is ended from here
+    watcher = std::thread([&] {
+      while (!finished && !interrupted) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      if (interrupted) {
+        server->stop();
+      }
+    });
+  }
+  try {
+    pipeline.run();
+  } catch (...) {
+    finished = true;
+    if (watcher.joinable()) {
+      watcher.join();
+    }
+    throw;
+  }
+  finished = true;
+  if (watcher.joinable()) {
+    watcher.join();
+  }
+  if (interrupted) {
+    std::clog << "interrupted, the frames already read were finished\n";
+  }
+  crop_writer.flush();
+  if (archive) {
+    archive->flush();
+  }
+  if (embeddings) {
+    embeddings->flush();
   }
 
-  delete [] read_data;
-  delete facenet;
-
-  if (need_io_cleanup) {
-    delete in;
+  std::clog << pipeline.get_stats() << "\n";
+  std::clog << "\tframe allocations: " << frame_pool.get_allocations() << "\n";
+  std::clog << "\t" << crop_writer.get_stats() << "\n";
+  if (archive) {
+    std::clog << "\t" << archive->get_stats() << "\n";
+  }
+  if (embeddings) {
+    std::clog << "\t" << embeddings->get_stats() << "\n";
+  }
+  if (server) {
+    std::clog << "\t" << server->get_stats() << "\n";
+  }
+  if (ring) {
+    std::clog << "\t" << ring->get_stats() << "\n";
+  }
+  if (!cache_dir.empty()) {
+    std::clog << "\t" << NetworkCache::get_stats() << "\n";
   }
 
   return 0;
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "command_line.hpp"
+#include "frame_file.hpp"
+#include "shm_ring.hpp"
+
+/*
+ * replays a capture file into a shared memory ring for detect_faces --shm.
+ *
+ *   shm_producer name capture.rgb24 [--width=1920] [--height=1080]
+ *                [--format=RGB24] [--fps=30] [--slots=4] [--loop]
+ *
+ * frames are published at --fps whether or not the reader keeps up, as a
+ * camera would; --fps=0 publishes as fast as possible.  the ring is removed
+ * when the replay ends or on SIGINT/SIGTERM.
+ */
+
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void on_signal(int) {
+  interrupted = 1;
+}
+
+static uint64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int main(int ac, char * av[]) {
+  CommandLine cmd(ac, av);
+  if (cmd.positional_count() < 2) {
+    std::cerr << "usage: shm_producer name capture.rgb24 [--width=1920] [--height=1080] [--format=RGB24]"
+                 " [--fps=30] [--slots=4] [--loop]" << std::endl;
+    return 1;
+  }
+
+  const std::string name = cmd.positional(0);
+  const int width = cmd.get<int>("width", 1920);
+  const int height = cmd.get<int>("height", 1080);
+  const PixelFormat format = parse_pixel_format(cmd.get("format", "RGB24"));
+  const double fps = cmd.get<double>("fps", 30);
+  const size_t slots = cmd.get<size_t>("slots", 4);
+  const bool loop = cmd.get("loop", false);
+
+  FrameFile file(cmd.positional(1), width, height, format);
+  if (file.get_frame_count() == 0) {
+    std::cerr << cmd.positional(1) << " holds no complete frame" << std::endl;
+    return 1;
+  }
+
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+
+  std::unique_ptr<ShmRing> ring = ShmRing::create(name, width, height, format, slots);
+  std::clog << "publishing " << file.get_frame_count() << " frames of " << width << "x" << height << " "
+            << to_string(format) << " to " << name << "\n";
+
+  const std::chrono::microseconds interval(fps > 0 ? (long long)(1e6 / fps) : 0);
+  auto due = std::chrono::steady_clock::now();
+  const size_t frame_size = file.get_frame_size();
+
+  for (size_t i = 0; !interrupted && (loop || i < file.get_frame_count()); i++) {
+    if (interval.count() > 0) {
+      std::this_thread::sleep_until(due);
+      due += interval;
+    }
+
+    const size_t index = i % file.get_frame_count();
+    file.prefetch(index + 1, 1);
+    int slot = ring->acquire();
+    if (slot < 0) {
+      continue;
+    }
+    std::memcpy(ring->image(slot).planes[0], file.frame(index).planes[0], frame_size);
+    ring->publish(slot, now_us());
+  }
+
+  ShmRing::stats s = ring->get_stats();
+  std::clog << "published: " << s.published << " dropped: " << s.dropped << "\n";
+  return 0;
+}
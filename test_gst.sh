@@ -2,3 +2,7 @@ gst-launch-1.0 -vvv v4l2src device=/dev/video0 ! videoscale ! "video/x-raw,width
 
 
 gst-launch-1.0 -vvv v4l2src device=/dev/video0 ! videoscale ! "video/x-raw,width=1920,height=1080" ! videoconvert ! "video/x-raw,format=RGB" ! tcpclientsink host=192.168.1.239 port=9990
+
+
+# detect_faces CPU --listen=tcp::9990 --width=1920 --height=1080
+gst-launch-1.0 -q v4l2src device=/dev/video0 ! videoscale ! "video/x-raw,width=1920,height=1080" ! videoconvert ! "video/x-raw,format=RGB" ! fdsink | ./frame_client tcp:192.168.1.239:9990 - --width=1920 --height=1080